@@ -0,0 +1,238 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <cstdint>
+
+namespace rb338
+{
+    // Building blocks for the synthesis generators. Each keeps its state in a small object and
+    // works one sample at a time, inline, so a generator's loop runs on multiply-adds instead
+    // of calls to exp, fmod and the random number generator.
+    namespace dsp
+    {
+        // exp(-rate * t) at t = n / sampleRate, as a running product. startSeconds shifts the
+        // start time for envelopes that begin part way through a sound. The product is kept in
+        // double so long tails stay within float rounding of the closed form.
+        class ExpDecay
+        {
+        public:
+            ExpDecay(float rate, double sampleRate, double startSeconds = 0.0)
+                : value(std::exp(-(double)rate * startSeconds)),
+                  coefficient(std::exp(-(double)rate / sampleRate))
+            {
+            }
+
+            float next()
+            {
+                const auto current = (float)value;
+                value *= coefficient;
+                return current;
+            }
+
+        private:
+            double value;
+            double coefficient;
+        };
+
+        // Phase in cycles, wrapped to 0..1 so it keeps its precision however long the sound.
+        // advance steps first and then returns the new phase. Increments must be below one
+        // cycle per sample.
+        class Phasor
+        {
+        public:
+            Phasor() = default;
+            Phasor(float frequency, double sampleRate)
+                : increment((float)(frequency / sampleRate)), inverse(increment > 0.0f ? 1.0f / increment : 0.0f)
+            {
+            }
+
+            float getPhase() const { return phase; }
+            float getIncrement() const { return increment; }
+            float getInverseIncrement() const { return inverse; }
+            float advance() { return advance(increment); }
+            float advance(float cycles)
+            {
+                phase += cycles;
+                if (phase >= 1.0f)
+                    phase -= 1.0f;
+                return phase;
+            }
+
+        private:
+            float phase = 0.0f;
+            float increment = 0.0f;
+            float inverse = 0.0f;
+        };
+
+        inline float sine(float phase) { return std::sin(juce::MathConstants<float>::twoPi * phase); }
+        inline float triangle(float phase) { return phase < 0.5f ? 4.0f * phase - 1.0f : 3.0f - 4.0f * phase; }
+        inline float square(float phase) { return phase < 0.5f ? 1.0f : -1.0f; }
+
+        // Residuals that smooth a step of 2 (polyBLEP) or a change of slope of 2 per sample
+        // (polyBLAMP) at phase 0 over the sample either side of it, for a phase moving increment
+        // cycles per sample, with inverse = 1 / increment.
+        inline float polyBlep(float phase, float increment, float inverse)
+        {
+            if (phase < increment)
+            {
+                const float t = phase * inverse;
+                return t + t - t * t - 1.0f;
+            }
+            if (phase > 1.0f - increment)
+            {
+                const float t = (phase - 1.0f) * inverse;
+                return t * t + t + t + 1.0f;
+            }
+            return 0.0f;
+        }
+
+        inline float polyBlamp(float phase, float increment, float inverse)
+        {
+            if (phase < increment)
+            {
+                const float t = phase * inverse - 1.0f;
+                return -t * t * t * (1.0f / 3.0f);
+            }
+            if (phase > 1.0f - increment)
+            {
+                const float t = (phase - 1.0f) * inverse + 1.0f;
+                return t * t * t * (1.0f / 3.0f);
+            }
+            return 0.0f;
+        }
+
+        // Band-limited square and triangle: the naive shapes with their corners smoothed, so
+        // partials above Nyquist no longer fold back down.
+        inline float square(float phase, float increment, float inverse)
+        {
+            const float half = phase < 0.5f ? phase + 0.5f : phase - 0.5f;
+            return square(phase) + polyBlep(phase, increment, inverse) - polyBlep(half, increment, inverse);
+        }
+
+        inline float triangle(float phase, float increment, float inverse)
+        {
+            const float half = phase < 0.5f ? phase + 0.5f : phase - 0.5f;
+            return triangle(phase) + 4.0f * increment * (polyBlamp(phase, increment, inverse) - polyBlamp(half, increment, inverse));
+        }
+
+        // White noise in -1..1. Each sample is a hash of its index and the seed, so there is no
+        // generator state beyond a counter.
+        class Noise
+        {
+        public:
+            explicit Noise(std::uint32_t seed) : key(seed * 0x9e3779b9u) {}
+
+            float next()
+            {
+                auto x = key + counter++;
+                x ^= x >> 16;
+                x *= 0x7feb352du;
+                x ^= x >> 15;
+                x *= 0x846ca68bu;
+                x ^= x >> 16;
+                return (float)(std::int32_t)x * (1.0f / 2147483648.0f);
+            }
+
+        private:
+            std::uint32_t key;
+            std::uint32_t counter = 0;
+        };
+
+        // One-pole filters. The cutoff is the 0-1 amount the state moves towards the input each
+        // sample, fixed when the filter is made.
+        class OnePoleLowPass
+        {
+        public:
+            explicit OnePoleLowPass(float cutoffAmount) : cutoff(cutoffAmount) {}
+
+            float process(float input)
+            {
+                state += (input - state) * cutoff;
+                return state;
+            }
+
+        private:
+            float cutoff;
+            float state = 0.0f;
+        };
+
+        class OnePoleHighPass
+        {
+        public:
+            explicit OnePoleHighPass(float cutoffAmount) : cutoff(cutoffAmount) {}
+
+            float process(float input)
+            {
+                const float output = input - state;
+                state += output * cutoff;
+                return output;
+            }
+
+        private:
+            float cutoff;
+            float state = 0.0f;
+        };
+
+        // The generators' band filter. Only its high-pass side has ever reached the output, at
+        // a fixed 0.55 gain, so that is all it computes.
+        class BandPass
+        {
+        public:
+            explicit BandPass(float highCutoff) : highPass(highCutoff) {}
+
+            float process(float input) { return highPass.process(input) * 0.55f; }
+
+        private:
+            OnePoleHighPass highPass;
+        };
+
+        // The closed forms the envelope and phasor above stand in for, worked out afresh every
+        // sample with exp and fmod. Slow; the tests and the benchmark measure the fast ones
+        // against them.
+        namespace reference
+        {
+            class ExpDecay
+            {
+            public:
+                ExpDecay(float decayRate, double rate, double startSeconds = 0.0)
+                    : decay(decayRate), sampleRate(rate), start(startSeconds)
+                {
+                }
+
+                float next() { return (float)std::exp(-decay * (start + (double)(index++) / sampleRate)); }
+
+            private:
+                double decay;
+                double sampleRate;
+                double start;
+                juce::int64 index = 0;
+            };
+
+            // The phase is kept unwrapped, in double, and wrapped when read.
+            class Phasor
+            {
+            public:
+                Phasor() = default;
+                Phasor(float frequency, double sampleRate)
+                    : increment((float)(frequency / sampleRate))
+                {
+                }
+
+                float getPhase() const { return (float)std::fmod(cycles, 1.0); }
+                float getIncrement() const { return increment; }
+                float getInverseIncrement() const { return increment > 0.0f ? 1.0f / increment : 0.0f; }
+                float advance() { return advance(increment); }
+                float advance(float step)
+                {
+                    cycles += step;
+                    return getPhase();
+                }
+
+            private:
+                double cycles = 0.0;
+                float increment = 0.0f;
+            };
+        }
+    }
+}
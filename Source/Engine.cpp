@@ -2,117 +2,501 @@
 
 namespace rb338
 {
+    // Sets the synthesis parameters automated on a trig. Returns true if there were any, as the
+    // sound then has to be rendered again.
+    static bool applySoundAutomation(InstrumentParams& params, const StepEvent& event)
+    {
+        auto has = [&event](AutomationParam param) { return (event.automationMask & (1 << (int)param)) != 0; };
+        auto value = [&event](AutomationParam param) { return event.automation[(int)param]; };
+        bool needsResynth = false;
+
+        if (has(AutomationParam::Tune))
+        {
+            params.tune = value(AutomationParam::Tune);
+            needsResynth = true;
+        }
+        if (has(AutomationParam::Decay))
+        {
+            params.decay = value(AutomationParam::Decay);
+            needsResynth = true;
+        }
+        if (has(AutomationParam::Tone))
+        {
+            params.tone = value(AutomationParam::Tone);
+            needsResynth = true;
+        }
+        if (has(AutomationParam::Snappy))
+        {
+            params.snappy = value(AutomationParam::Snappy);
+            needsResynth = true;
+        }
+
+        return needsResynth;
+    }
+
+    Engine::Engine()
+    {
+        // General MIDI drum map, which most pad controllers send out of the box.
+        for (int note = 0; note < 128; ++note)
+        {
+            const auto drum = PatternIO::drumForNote(note);
+            midiNoteMap[note].store(drum == Instrument::Count ? -1 : (int)drum, std::memory_order_relaxed);
+        }
+
+        for (auto& variant : trackVariant)
+            variant = -1;
+
+        publishKit(std::make_unique<SampleKit>());
+    }
+
     void Engine::prepare(double newSampleRate, int samplesPerBlock, int numOutputs)
     {
-        juce::ignoreUnused(samplesPerBlock, numOutputs);
+        juce::ignoreUnused(numOutputs);
         sampleRate = newSampleRate;
-        sampleLibrary.prepare(sampleRate);
+        synthWorker.stop();
         sequencer.prepare(sampleRate);
+        upcomingAutomation.ensureStorageAllocated(Sequencer::maxUpcomingAutomation);
+        skippedPrefetches.store(0, std::memory_order_relaxed);
+        scheduledEvents.ensureStorageAllocated(Sequencer::maxScheduledEvents + maxMidiNotesPerBlock);
+        droppedNotes.store(0, std::memory_order_relaxed);
+        liveInputs.ensureStorageAllocated(128);
+        {
+            const juce::SpinLock::ScopedLockType sl(pendingTriggerLock);
+            pendingTriggers.ensureStorageAllocated(128);
+        }
+        setOutputLatency(samplesPerBlock);
+        midiCollector.reset(sampleRate);
+        midiInput.ensureSize(2048);
+        clockFollower.prepare(sampleRate);
+        clockAnchored = false;
+        renderedSamples = 0;
+        clockMessages.ensureStorageAllocated(64);
+        // The block is heard one block later, and the sender may pick it up a little after that.
+        midiOutputLatencyMs = 1000.0 * juce::jmax(1, samplesPerBlock) / sampleRate + MidiClockSender::drainIntervalMs;
         setupDelay(sampleRate);
+        mixBus.setSize(5, juce::jmax(256, samplesPerBlock));
+
+        for (int track = 0; track < maxTracks; ++track)
+        {
+            voices[track].clearQuick();
+            voices[track].ensureStorageAllocated(16);
+            trackVariant[track] = -1;
+            prebuiltSound[track] = nullptr;
+            prebuiltVersion[track] = 0;
+
+            // Nothing plays while preparing, so only each track's current sound is still needed.
+            playingTrackSound[track] = nullptr;
+            if (const auto* current = trackSounds[track].published.load(std::memory_order_relaxed))
+                trackSounds[track].inUse.store(current->version, std::memory_order_release);
+        }
+        soundingTracks = 0;
+        stereoTracks = 0;
+        awaitingVariant = 0;
+        playingSounds = nullptr;
+        soundsChanged.store(0, std::memory_order_relaxed);
+
+        // The selected kit is at the old rate, so it is opened again at this one.
+        kitsInUse.store(getSelectedKit().version, std::memory_order_release);
+        const auto kitFile = getSelectedKit().getFile();
+        if (kitFile != juce::File() && !selectKit(kitFile))
+            selectKit({});
 
-        for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-            updateInstrumentSound((Instrument)inst);
+        // Every model track, the built-in kit included, renders at the new rate in one batch.
+        const auto startMs = juce::Time::getMillisecondCounterHiRes();
+        juce::Array<SampleLibrary::RenderRequest> renders;
+        juce::Array<int> renderTracks;
+        for (auto active = tracks.getActiveMask(); active != 0; active &= active - 1)
+        {
+            const TrackId track(StepBits::lowest(active));
+            if (tracks.getSource(track) != TrackSource::Model)
+                continue;
+
+            SampleLibrary::RenderRequest request;
+            request.model = tracks.getModel(track);
+            request.params = channels[track.index].params;
+            renders.add(request);
+            renderTracks.add(track.index);
+        }
+
+        sampleLibrary.renderAll(renders, sampleRate);
+        for (int i = 0; i < renders.size(); ++i)
+            publishTrackSound(renderTracks[i], std::move(renders.getReference(i).result));
+
+        juce::Logger::writeToLog("LoS.9x9: Rendered the kit at " + juce::String(sampleRate, 0) + " Hz in "
+                                 + juce::String(juce::Time::getMillisecondCounterHiRes() - startMs, 1) + " ms.");
+
+        synthWorker.prepare(sampleRate);
+    }
+
+    void Engine::release()
+    {
+        sequencer.release();
     }
 
     void Engine::render(juce::AudioBuffer<float>& buffer, int numSamples)
     {
         buffer.clear();
-        juce::Array<StepEvent> events;
-        juce::Array<StepEvent> pending;
 
         {
             const juce::SpinLock::ScopedLockType sl(pendingTriggerLock);
-            pending.swapWith(pendingTriggers);
+            liveInputs.swapWith(pendingTriggers);
         }
 
-        for (const auto& event : pending)
-            triggerVoice(event);
+        // A knob moved: the track goes back to the sound rendered for its new settings.
+        for (auto changed = soundsChanged.exchange(0, std::memory_order_acquire); changed != 0; changed &= changed - 1)
+            setTrackVariant(StepBits::lowest(changed), -1);
 
-        for (int i = 0; i < numSamples; ++i)
+        midiInput.clear();
+        midiCollector.removeNextBlockOfMessages(midiInput, numSamples);
+
+        sequencer.acquirePattern();
+        playingSounds = publishedSounds.load(std::memory_order_acquire);
+        playingKit = publishedKit.load(std::memory_order_acquire);
+        for (int track = 0; track < maxTracks; ++track)
+            playingTrackSound[track] = trackSounds[track].published.load(std::memory_order_acquire);
+        followMidiClock(numSamples);
+
+        // Everything that arrived since the last callback, placed relative to this block's start.
+        const double blockMs = juce::Time::getMillisecondCounterHiRes();
+        for (const auto& input : liveInputs)
         {
-            if (sequencer.nextSample(events))
+            if (input.record.type == RecordedEvent::Type::Hit)
             {
-                for (auto& event : events)
+                StepEvent event;
+                event.track = input.record.track;
+                event.velocity = input.record.value;
+                event.accent = input.record.accent;
+                event.stepIndex = -1;
+                triggerVoice(event);
+            }
+
+            captureLiveInput(input.record, (input.arrivalMs - blockMs) * 0.001 * sampleRate);
+        }
+        liveInputs.clearQuick();
+        sequencer.renderBlock(numSamples, scheduledEvents, clockMessages);
+        mergeMidiInput(numSamples);
+        prefetchAutomation();
+        sendMidiClock();
+        renderedSamples += numSamples;
+
+        updateTrackMix();
+
+        // Render up to each event's exact sample offset, fire it, then carry on.
+        int position = 0;
+        for (const auto& scheduled : scheduledEvents)
+        {
+            renderRange(buffer, position, scheduled.offset);
+            position = juce::jmax(position, scheduled.offset);
+            applyAutomation(scheduled.event);
+            triggerVoice(scheduled.event);
+        }
+
+        renderRange(buffer, position, numSamples);
+        acknowledgePatternSounds();
+        acknowledgeKit();
+        acknowledgeTrackSounds();
+    }
+
+    void Engine::postLiveInput(const RecordedEvent& record)
+    {
+        LiveInput input;
+        input.record = record;
+        input.arrivalMs = juce::Time::getMillisecondCounterHiRes();
+
+        const juce::SpinLock::ScopedLockType sl(pendingTriggerLock);
+        pendingTriggers.add(input);
+    }
+
+    void Engine::captureLiveInput(RecordedEvent record, double offset)
+    {
+        if (!recordArmed.load(std::memory_order_relaxed) || !sequencer.isRunning())
+            return;
+
+        // What the player was hearing when this arrived left the engine one output latency ago.
+        record.phase = sequencer.getPhaseAtOffset(offset - (double)outputLatencySamples.load(std::memory_order_relaxed));
+        if (record.phase < -0.5)
+            return;
+
+        const auto scope = recordQueue.write(1);
+        if (scope.blockSize1 > 0)
+            recordedEvents[(size_t)scope.startIndex1] = record;
+    }
+
+    void Engine::followMidiClock(int numSamples)
+    {
+        const bool sync = sequencer.isExternalSync();
+        if (!sync)
+            clockAnchored = false;
+
+        const double blockStart = (double)renderedSamples;
+        for (const auto metadata : midiInput)
+        {
+            const auto message = metadata.getMessage();
+            if (message.isMidiClock())
+            {
+                clockFollower.pulse(blockStart + metadata.samplePosition);
+            }
+            else if (message.isMidiStart())
+            {
+                clockFollower.start();
+                if (sync)
                 {
-                    applyAutomationForStep(event.instrument, event.stepIndex);
-                    triggerVoice(event);
+                    sequencer.setRunning(true);
+                    clockAnchored = true;
                 }
             }
+            else if (message.isMidiContinue())
+            {
+                clockFollower.start(stoppedAtPulse);
+                if (sync)
+                {
+                    sequencer.continuePlayback();
+                    clockAnchored = true;
+                }
+            }
+            else if (message.isMidiStop())
+            {
+                // Pulses keep coming while the master is stopped; Continue picks up from here.
+                stoppedAtPulse = clockFollower.getNextPulse();
+                if (sync)
+                    sequencer.setRunning(false);
+            }
+        }
+
+        clockFollower.advanceTo(blockStart + numSamples);
+        const bool locked = clockFollower.isLocked();
+        clockLocked.store(locked, std::memory_order_relaxed);
 
-            float left = 0.0f;
-            float right = 0.0f;
-            float delaySend = 0.0f;
+        if (!sync || !locked || !sequencer.isRunning())
+            return;
 
-            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+        if (clockAnchored)
+        {
+            const auto pulse = clockFollower.getNextPulse();
+            sequencer.syncToClock((double)pulse / Sequencer::clockPulsesPerStep,
+                                  clockFollower.getPulseTime((double)pulse) - blockStart,
+                                  clockFollower.getBpm());
+        }
+        else
+        {
+            sequencer.followClockTempo(clockFollower.getBpm());
+        }
+    }
+
+    void Engine::sendMidiClock()
+    {
+        // Queued for the sender's thread, stamped with when the block will be heard.
+        const double blockMs = juce::Time::getMillisecondCounterHiRes() + midiOutputLatencyMs;
+        for (const auto& message : clockMessages)
+        {
+            const double timeMs = blockMs + 1000.0 * message.offset / sampleRate;
+            switch (message.type)
             {
-                auto instrument = (Instrument)inst;
-                float sample = renderInstrument(instrument);
-                if (sample == 0.0f)
-                    continue;
+                case ClockMessage::Type::Pulse: clockSender.push(juce::MidiMessage::midiClock(), timeMs); break;
+                case ClockMessage::Type::Start: clockSender.push(juce::MidiMessage::midiStart(), timeMs); break;
+                case ClockMessage::Type::Continue: clockSender.push(juce::MidiMessage::midiContinue(), timeMs); break;
+                case ClockMessage::Type::Stop: clockSender.push(juce::MidiMessage::midiStop(), timeMs); break;
+            }
+        }
+    }
 
-                auto& channel = channels[inst];
-                float level = channel.level;
-                float pan = juce::jlimit(-1.0f, 1.0f, channel.pan);
-                float panLeft = std::cos((pan + 1.0f) * juce::MathConstants<float>::halfPi * 0.5f);
-                float panRight = std::sin((pan + 1.0f) * juce::MathConstants<float>::halfPi * 0.5f);
+    void Engine::mergeMidiInput(int numSamples)
+    {
+        for (const auto metadata : midiInput)
+        {
+            const auto message = metadata.getMessage();
+            if (!message.isNoteOn())
+                continue;
 
-                float mono = sample * level;
-                left += mono * panLeft;
-                right += mono * panRight;
-                delaySend += mono * channel.delaySend;
+            const int note = message.getNoteNumber();
+            if (midiLearnTarget.load(std::memory_order_relaxed) >= 0)
+            {
+                const int target = midiLearnTarget.exchange(-1);
+                if (target >= 0)
+                    midiNoteMap[note].store(target, std::memory_order_relaxed);
             }
 
-            int readPos = (delayWritePos + delayBuffer.getNumSamples() - delaySamples) % delayBuffer.getNumSamples();
-            float delayedL = delayBuffer.getSample(0, readPos);
-            float delayedR = delayBuffer.getSample(1, readPos);
+            const TrackId track(midiNoteMap[note].load(std::memory_order_relaxed));
+            if (!tracks.isActive(track))
+                continue;
 
-            delayBuffer.setSample(0, delayWritePos, left + delayedL * delayFeedback + delaySend);
-            delayBuffer.setSample(1, delayWritePos, right + delayedR * delayFeedback + delaySend);
+            ScheduledEvent scheduled;
+            scheduled.event.track = track;
+            scheduled.event.accent = message.getVelocity() >= midiAccentThreshold.load(std::memory_order_relaxed);
+            scheduled.event.velocity = scheduled.event.accent ? 1.0f : juce::jmap(message.getFloatVelocity(), 0.3f, 0.85f);
+            scheduled.event.stepIndex = -1;
+            scheduled.offset = juce::jlimit(0, juce::jmax(0, numSamples - 1), metadata.samplePosition);
 
-            left += delayedL * delayMix;
-            right += delayedR * delayMix;
+            // The collector spreads the previous callback period over this block, so a note
+            // arrived numSamples before its offset; the transport has since moved one block on.
+            RecordedEvent record;
+            record.track = scheduled.event.track;
+            record.value = scheduled.event.velocity;
+            record.accent = scheduled.event.accent;
+            captureLiveInput(record, (double)(metadata.samplePosition - 2 * numSamples));
 
-            // Accent-dependent low-end thump reinforcement for kick accents.
-            if (kickThumpEnv > 0.0001f)
+            if (scheduledEvents.size() >= Sequencer::maxScheduledEvents + maxMidiNotesPerBlock)
             {
-                float thump = std::sin(kickThumpPhase) * kickThumpEnv * 0.12f;
-                kickThumpPhase += juce::MathConstants<float>::twoPi * 48.0f / (float)sampleRate;
-                if (kickThumpPhase > juce::MathConstants<float>::twoPi)
-                    kickThumpPhase -= juce::MathConstants<float>::twoPi;
-                kickThumpEnv *= 0.9982f;
-
-                left += thump;
-                right += thump;
+                droppedNotes.fetch_add(1, std::memory_order_relaxed);
+                continue;
             }
 
-            // Soft protection keeps accents powerful but avoids harsh clipping.
-            left = safeSaturate(left, 1.08f);
-            right = safeSaturate(right, 1.08f);
-            const float peak = juce::jmax(std::abs(left), std::abs(right));
-            if (peak > 0.98f)
+            // Keep the block's events in time order; notes go after sequencer hits on the same sample.
+            int insertAt = scheduledEvents.size();
+            while (insertAt > 0 && scheduledEvents.getReference(insertAt - 1).offset > scheduled.offset)
+                --insertAt;
+            scheduledEvents.insert(insertAt, scheduled);
+        }
+    }
+
+    void Engine::updateTrackMix()
+    {
+        for (auto active = tracks.getActiveMask(); active != 0; active &= active - 1)
+        {
+            const int track = StepBits::lowest(active);
+            const auto& channel = channels[track];
+            const float pan = juce::jlimit(-1.0f, 1.0f, channel.pan);
+            const float angle = (pan + 1.0f) * juce::MathConstants<float>::halfPi * 0.5f;
+
+            trackMix.gainLeft[track] = channel.level * std::cos(angle);
+            trackMix.gainRight[track] = channel.level * std::sin(angle);
+            trackMix.send[track] = channel.level * channel.delaySend;
+        }
+    }
+
+    void Engine::renderRange(juce::AudioBuffer<float>& buffer, int startSample, int endSample)
+    {
+        while (startSample < endSample)
+        {
+            const int numSamples = juce::jmin(endSample - startSample, mixBus.getNumSamples());
+            auto* mixLeft = mixBus.getWritePointer(0);
+            auto* mixRight = mixBus.getWritePointer(1);
+            auto* mixSend = mixBus.getWritePointer(2);
+            auto* scratch = mixBus.getWritePointer(3);
+            auto* scratchRight = mixBus.getWritePointer(4);
+
+            juce::FloatVectorOperations::clear(mixLeft, numSamples);
+            juce::FloatVectorOperations::clear(mixRight, numSamples);
+            juce::FloatVectorOperations::clear(mixSend, numSamples);
+
+            for (auto sounding = soundingTracks; sounding != 0; sounding &= sounding - 1)
             {
-                const float trim = 0.98f / peak;
-                left *= trim;
-                right *= trim;
+                const int track = StepBits::lowest(sounding);
+                juce::FloatVectorOperations::clear(scratch, numSamples);
+                if ((stereoTracks & ((juce::uint64)1 << track)) == 0)
+                {
+                    renderTrack(track, scratch, nullptr, numSamples);
+                    juce::FloatVectorOperations::addWithMultiply(mixLeft, scratch, trackMix.gainLeft[track], numSamples);
+                    juce::FloatVectorOperations::addWithMultiply(mixRight, scratch, trackMix.gainRight[track], numSamples);
+                    juce::FloatVectorOperations::addWithMultiply(mixSend, scratch, trackMix.send[track], numSamples);
+                    continue;
+                }
+
+                // A stereo sound keeps its own image: each side goes to its own output and the
+                // pan gains balance them, rather than panning one signal across both.
+                juce::FloatVectorOperations::clear(scratchRight, numSamples);
+                renderTrack(track, scratch, scratchRight, numSamples);
+                juce::FloatVectorOperations::addWithMultiply(mixLeft, scratch, trackMix.gainLeft[track], numSamples);
+                juce::FloatVectorOperations::addWithMultiply(mixRight, scratchRight, trackMix.gainRight[track], numSamples);
+                juce::FloatVectorOperations::addWithMultiply(mixSend, scratch, trackMix.send[track] * 0.5f, numSamples);
+                juce::FloatVectorOperations::addWithMultiply(mixSend, scratchRight, trackMix.send[track] * 0.5f, numSamples);
             }
 
-            delayWritePos = (delayWritePos + 1) % delayBuffer.getNumSamples();
+            for (int n = 0; n < numSamples; ++n)
+            {
+                const int i = startSample + n;
+                float left = mixLeft[n];
+                float right = mixRight[n];
+                const float delaySend = mixSend[n];
+
+                int readPos = (delayWritePos + delayBuffer.getNumSamples() - delaySamples) % delayBuffer.getNumSamples();
+                float delayedL = delayBuffer.getSample(0, readPos);
+                float delayedR = delayBuffer.getSample(1, readPos);
+
+                delayBuffer.setSample(0, delayWritePos, left + delayedL * delayFeedback + delaySend);
+                delayBuffer.setSample(1, delayWritePos, right + delayedR * delayFeedback + delaySend);
+
+                left += delayedL * delayMix;
+                right += delayedR * delayMix;
+
+                // Accent-dependent low-end thump reinforcement for kick accents.
+                if (kickThumpEnv > 0.0001f)
+                {
+                    float thump = std::sin(kickThumpPhase) * kickThumpEnv * 0.12f;
+                    kickThumpPhase += juce::MathConstants<float>::twoPi * 48.0f / (float)sampleRate;
+                    if (kickThumpPhase > juce::MathConstants<float>::twoPi)
+                        kickThumpPhase -= juce::MathConstants<float>::twoPi;
+                    kickThumpEnv *= 0.9982f;
+
+                    left += thump;
+                    right += thump;
+                }
+
+                // Soft protection keeps accents powerful but avoids harsh clipping.
+                left = safeSaturate(left, 1.08f);
+                right = safeSaturate(right, 1.08f);
+                const float peak = juce::jmax(std::abs(left), std::abs(right));
+                if (peak > 0.98f)
+                {
+                    const float trim = 0.98f / peak;
+                    left *= trim;
+                    right *= trim;
+                }
+
+                delayWritePos = (delayWritePos + 1) % delayBuffer.getNumSamples();
 
-            buffer.setSample(0, i, left);
-            buffer.setSample(1, i, right);
+                buffer.setSample(0, i, left);
+                buffer.setSample(1, i, right);
+            }
+
+            startSample += numSamples;
         }
     }
 
-    void Engine::triggerInstrument(Instrument instrument, float velocity)
+    void Engine::triggerInstrument(TrackId track, float velocity)
     {
-        StepEvent event;
-        event.instrument = instrument;
-        event.velocity = juce::jlimit(0.0f, 1.0f, velocity);
-        event.flam = false;
-        event.stepIndex = -1;
+        RecordedEvent hit;
+        hit.track = track;
+        hit.value = juce::jlimit(0.0f, 1.0f, velocity);
+        postLiveInput(hit);
+    }
 
-        const juce::SpinLock::ScopedLockType sl(pendingTriggerLock);
-        pendingTriggers.add(event);
+    void Engine::setRecording(bool shouldRecord)
+    {
+        recordArmed.store(shouldRecord, std::memory_order_relaxed);
+    }
+
+    void Engine::setOutputLatency(int samples)
+    {
+        outputLatencySamples.store(juce::jmax(0, samples), std::memory_order_relaxed);
+        sequencer.setOutputLatency(samples);
+    }
+
+    void Engine::recordAutomation(TrackId track, AutomationParam param, float value)
+    {
+        RecordedEvent move;
+        move.type = RecordedEvent::Type::Automation;
+        move.track = track;
+        move.param = param;
+        move.value = value;
+        postLiveInput(move);
+    }
+
+    void Engine::recordTempo(float bpm)
+    {
+        RecordedEvent move;
+        move.type = RecordedEvent::Type::Tempo;
+        move.value = bpm;
+        postLiveInput(move);
+    }
+
+    bool Engine::popRecordedEvent(RecordedEvent& event)
+    {
+        const auto scope = recordQueue.read(1);
+        if (scope.blockSize1 == 0)
+            return false;
+        event = recordedEvents[(size_t)scope.startIndex1];
+        return true;
     }
 
     void Engine::setBpm(float bpm)
@@ -125,6 +509,11 @@ namespace rb338
         sequencer.setRunning(running);
     }
 
+    void Engine::continuePlayback()
+    {
+        sequencer.continuePlayback();
+    }
+
     bool Engine::isRunning() const
     {
         return sequencer.isRunning();
@@ -140,6 +529,65 @@ namespace rb338
         return accentLevel;
     }
 
+    juce::MidiMessageCollector& Engine::getMidiCollector()
+    {
+        return midiCollector;
+    }
+
+    void Engine::setMidiNoteMapping(int note, TrackId track)
+    {
+        if (note >= 0 && note < 128)
+            midiNoteMap[note].store(track.isValid() ? track.index : -1, std::memory_order_relaxed);
+    }
+
+    TrackId Engine::getMidiNoteMapping(int note) const
+    {
+        if (note < 0 || note >= 128)
+            return TrackId(-1);
+        return TrackId(midiNoteMap[note].load(std::memory_order_relaxed));
+    }
+
+    void Engine::learnMidiNote(TrackId track)
+    {
+        if (track.isValid())
+            midiLearnTarget.store(track.index, std::memory_order_relaxed);
+    }
+
+    void Engine::setMidiAccentThreshold(int velocity)
+    {
+        midiAccentThreshold.store(juce::jlimit(1, 127, velocity), std::memory_order_relaxed);
+    }
+
+    void Engine::setMidiClockOutput(std::unique_ptr<juce::MidiOutput> output)
+    {
+        clockSender.setOutput(std::move(output));
+    }
+
+    void Engine::setExternalClockSync(bool shouldSync)
+    {
+        sequencer.setExternalSync(shouldSync);
+    }
+
+    bool Engine::isExternalClockSync() const
+    {
+        return sequencer.isExternalSync();
+    }
+
+    bool Engine::isExternalClockLocked() const
+    {
+        return clockLocked.load(std::memory_order_relaxed);
+    }
+
+    int Engine::getDroppedEvents() const
+    {
+        return sequencer.getDroppedEvents() + droppedNotes.load(std::memory_order_relaxed);
+    }
+
+    int Engine::getSkippedPrefetches() const
+    {
+        return skippedPrefetches.load(std::memory_order_relaxed);
+    }
+
     Sequencer& Engine::getSequencer()
     {
         return sequencer;
@@ -150,97 +598,471 @@ namespace rb338
         return sampleLibrary;
     }
 
-    MixerChannel& Engine::getChannel(Instrument instrument)
+    const TrackRegistry& Engine::getTracks() const
     {
-        return channels[(int)instrument];
+        return tracks;
     }
 
-    void Engine::updateInstrumentSound(Instrument instrument)
+    int Engine::addModelTrack(Instrument model, const juce::String& name)
     {
-        sampleLibrary.regenerate(instrument, sampleRate, channels[(int)instrument].params);
+        if (model == Instrument::Count)
+            return -1;
+
+        const int track = tracks.findFreeSlot();
+        if (track < 0)
+            return -1;
+
+        // The slot gets its settings and sound before it is active. Voices still ringing from a
+        // track removed from the slot keep the sound they play until they end.
+        channels[track] = MixerChannel();
+        publishTrackSound(track, sampleLibrary.render(model, sampleRate, channels[track].params));
+        tracks.addModelTrack(track, model, name);
+        return track;
     }
 
-    float Engine::renderInstrument(Instrument instrument)
+    int Engine::addSampleTrack(const juce::File& file, Instrument borrowedModel)
     {
-        auto& list = voices[(int)instrument];
-        if (list.isEmpty())
-            return 0.0f;
+        Sample loaded;
+        if (borrowedModel == Instrument::Count || !SampleLibrary::readFile(file, loaded))
+            return -1;
+
+        const int track = tracks.findFreeSlot();
+        if (track < 0)
+            return -1;
+
+        channels[track] = MixerChannel();
+        publishTrackSound(track, std::move(loaded));
+        tracks.addSampleTrack(track, file, borrowedModel);
+        return track;
+    }
+
+    void Engine::removeTrack(TrackId track)
+    {
+        if (!tracks.removeTrack(track))
+            return;
+
+        soundsChanged.fetch_or((juce::uint64)1 << track.index, std::memory_order_release);
+
+        for (int note = 0; note < 128; ++note)
+        {
+            int mapped = track.index;
+            midiNoteMap[note].compare_exchange_strong(mapped, -1, std::memory_order_relaxed);
+        }
+    }
+
+    MixerChannel& Engine::getChannel(TrackId track)
+    {
+        return channels[juce::jlimit(0, maxTracks - 1, track.index)];
+    }
+
+    void Engine::updateInstrumentSound(TrackId track)
+    {
+        if (!track.isValid())
+            return;
+
+        renderTrackSound(track);
+        soundsChanged.fetch_or((juce::uint64)1 << track.index, std::memory_order_release);
+    }
+
+    bool Engine::installReferencePack()
+    {
+        if (!sampleLibrary.isReferencePackReady())
+            return false;
+
+        // The worker's renders read the reference samples, so it waits while they change.
+        synthWorker.stop();
+        const auto changed = sampleLibrary.installReferencePack();
+        for (auto active = tracks.getActiveMask(); active != 0; active &= active - 1)
+        {
+            const TrackId track(StepBits::lowest(active));
+            if (tracks.getSource(track) == TrackSource::Model && changed.contains(tracks.getModel(track)))
+                updateInstrumentSound(track);
+        }
+        synthWorker.start();
+
+        return !changed.isEmpty();
+    }
+
+    juce::Array<juce::File> Engine::listKits() const
+    {
+        return SampleKit::findKits(SampleKit::getDefaultDirectory());
+    }
+
+    bool Engine::selectKit(const juce::File& file)
+    {
+        auto kit = file == juce::File() ? std::make_unique<SampleKit>() : SampleKit::openAt(file, sampleRate);
+        if (kit == nullptr)
+            return false;
+
+        publishKit(std::move(kit));
+        return true;
+    }
+
+    const SampleKit& Engine::getSelectedKit() const
+    {
+        return *publishedKit.load(std::memory_order_relaxed);
+    }
+
+    void Engine::publishKit(std::unique_ptr<SampleKit> kit)
+    {
+        const auto inUse = kitsInUse.load(std::memory_order_acquire);
+        const auto* current = publishedKit.load(std::memory_order_relaxed);
+        for (int i = kits.size() - 1; i >= 0; --i)
+        {
+            auto* old = kits[i];
+            if (old != current && old->version < inUse)
+                kits.remove(i);
+        }
+
+        kit->version = nextKitVersion++;
+        publishedKit.store(kits.add(kit.release()), std::memory_order_release);
+    }
+
+    void Engine::renderTrackSound(TrackId track)
+    {
+        if (tracks.isActive(track) && tracks.getSource(track) == TrackSource::Model)
+            publishTrackSound(track.index, sampleLibrary.render(tracks.getModel(track), sampleRate, channels[track.index].params));
+    }
+
+    void Engine::publishTrackSound(int track, Sample sound)
+    {
+        auto& slot = trackSounds[track];
+        const auto inUse = slot.inUse.load(std::memory_order_acquire);
+        const auto* current = slot.published.load(std::memory_order_relaxed);
+        for (int i = slot.sounds.size() - 1; i >= 0; --i)
+        {
+            const auto* old = slot.sounds[i];
+            if (old != current && old->version < inUse)
+                slot.sounds.remove(i);
+        }
+
+        auto* published = new TrackSound();
+        published->sample = std::move(sound);
+        published->version = nextTrackSoundVersion++;
+        slot.published.store(slot.sounds.add(published), std::memory_order_release);
+    }
+
+    void Engine::loadPatternSounds(const PatternGrid& pattern, int length)
+    {
+        const auto inUse = soundsInUse.load(std::memory_order_acquire);
+        const auto* current = publishedSounds.load(std::memory_order_relaxed);
+        for (int i = patternSounds.size() - 1; i >= 0; --i)
+        {
+            auto* sounds = patternSounds[i];
+            if (sounds != current && sounds->version < inUse)
+                patternSounds.remove(i);
+        }
+
+        auto* sounds = new PatternSounds();
+        sounds->version = nextSoundsVersion++;
+        sounds->sampleRate = sampleRate;
+
+        PatternSnapshot snapshot;
+        snapshot.compile(pattern, juce::jlimit(1, maxPatternSteps, length));
+
+        // Two passes over the loop. The first starts from the channels as they are now, the
+        // second from what the first leaves on them, which is where every later loop starts.
+        // Trigs are bound to the second; the first loop's sounds are kept where they differ.
+        InstrumentParams params[maxTracks];
+        for (int track = 0; track < maxTracks; ++track)
+            params[track] = channels[track].params;
+
+        juce::Array<SampleLibrary::RenderRequest> renders;
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (const auto& event : snapshot.events)
+            {
+                if (!tracks.isActive(event.track) || tracks.getSource(event.track) != TrackSource::Model)
+                    continue;
+
+                const int track = event.track.index;
+                if (!applySoundAutomation(params[track], event))
+                    continue;
+
+                const auto model = tracks.getModel(event.track);
+                int variant = sounds->find(track, -1, model, params[track]);
+                if (variant < 0)
+                {
+                    PatternSounds::Variant added;
+                    added.track = track;
+                    added.model = model;
+                    added.params = params[track];
+                    variant = sounds->variants.size();
+                    sounds->variants.add(added);
+
+                    SampleLibrary::RenderRequest request;
+                    request.model = model;
+                    request.params = params[track];
+                    renders.add(request);
+                }
+
+                sounds->binding[track][event.stepIndex] = (juce::int16)variant;
+            }
+        }
+
+        sampleLibrary.renderAll(renders, sounds->sampleRate);
+        for (int i = 0; i < renders.size(); ++i)
+            sounds->variants.getReference(i).sample = std::move(renders.getReference(i).result);
+
+        patternSounds.add(sounds);
+        publishedSounds.store(sounds, std::memory_order_release);
+    }
+
+    void Engine::acknowledgePatternSounds()
+    {
+        if (playingSounds == nullptr)
+            return;
+
+        auto oldest = playingSounds->version;
+        for (int track = 0; track < maxTracks; ++track)
+            if (prebuiltVersion[track] != 0)
+                oldest = juce::jmin(oldest, prebuiltVersion[track]);
+
+        for (auto sounding = soundingTracks; sounding != 0; sounding &= sounding - 1)
+            for (const auto& voice : voices[StepBits::lowest(sounding)])
+                if (voice.soundsVersion != 0)
+                    oldest = juce::jmin(oldest, voice.soundsVersion);
+
+        soundsInUse.store(oldest, std::memory_order_release);
+    }
 
-        float sum = 0.0f;
+    void Engine::acknowledgeKit()
+    {
+        auto oldest = playingKit->version;
+        for (auto sounding = soundingTracks; sounding != 0; sounding &= sounding - 1)
+            for (const auto& voice : voices[StepBits::lowest(sounding)])
+                if (voice.kitVersion != 0)
+                    oldest = juce::jmin(oldest, voice.kitVersion);
+
+        kitsInUse.store(oldest, std::memory_order_release);
+    }
+
+    void Engine::acknowledgeTrackSounds()
+    {
+        for (int track = 0; track < maxTracks; ++track)
+        {
+            if (playingTrackSound[track] == nullptr)
+                continue;
+
+            auto oldest = playingTrackSound[track]->version;
+            for (const auto& voice : voices[track])
+                if (voice.trackSoundVersion != 0)
+                    oldest = juce::jmin(oldest, voice.trackSoundVersion);
+
+            trackSounds[track].inUse.store(oldest, std::memory_order_release);
+        }
+    }
+
+    void Engine::renderTrack(int track, float* left, float* right, int numSamples)
+    {
+        auto& list = voices[track];
         for (int i = list.size(); --i >= 0;)
         {
             auto& voice = list.getReference(i);
-            if (!voice.sample || voice.position >= voice.sample->data.getNumSamples())
+            const int length = voice.sample != nullptr ? voice.sample->data.getNumSamples() : 0;
+            const int count = juce::jmin(numSamples, length - voice.position);
+            if (count > 0)
             {
-                list.remove(i);
-                continue;
+                // On a stereo track a mono voice goes to both sides, as it would when panned.
+                const auto& data = voice.sample->data;
+                juce::FloatVectorOperations::addWithMultiply(left, data.getReadPointer(0, voice.position), voice.gain, count);
+                if (right != nullptr)
+                    juce::FloatVectorOperations::addWithMultiply(right, data.getReadPointer(data.getNumChannels() > 1 ? 1 : 0, voice.position), voice.gain, count);
+                voice.position += count;
             }
 
-            sum += voice.sample->data.getSample(0, voice.position) * voice.gain;
-            voice.position++;
+            if (voice.position >= length)
+            {
+                if (voice.variant >= 0)
+                    synthWorker.release(voice.variant);
+                list.remove(i);
+            }
         }
 
-        return sum;
+        if (list.isEmpty())
+        {
+            soundingTracks &= ~((juce::uint64)1 << track);
+            stereoTracks &= ~((juce::uint64)1 << track);
+        }
     }
 
     void Engine::triggerVoice(const StepEvent& event)
     {
-        if (event.instrument == Instrument::ClosedHat)
+        if (!tracks.isActive(event.track))
+            return;
+
+        // Choke the open hat from the closed hat, as the kit's hat pair shares one voice.
+        if (event.track == TrackId(Instrument::ClosedHat))
             clearVoices(Instrument::OpenHat);
 
+        const auto model = tracks.getModel(event.track);
+        const int track = event.track.index;
         VoiceInstance voice;
-        voice.sample = &sampleLibrary.get(event.instrument);
+        const auto* kitSound = event.track.isBuiltIn() ? playingKit->getSound((Instrument)track) : nullptr;
+        if (kitSound != nullptr)
+        {
+            voice.sample = kitSound;
+            voice.kitVersion = playingKit->version;
+        }
+        else
+        {
+            if ((awaitingVariant & ((juce::uint64)1 << track)) != 0)
+                pickUpQueuedSound(track);
+
+            voice.variant = trackVariant[track];
+            voice.soundsVersion = prebuiltVersion[track];
+            if (prebuiltSound[track] != nullptr)
+            {
+                voice.sample = prebuiltSound[track];
+            }
+            else if (voice.variant >= 0)
+            {
+                voice.sample = &synthWorker.getSample(voice.variant);
+            }
+            else if (playingTrackSound[track] != nullptr)
+            {
+                voice.sample = &playingTrackSound[track]->sample;
+                voice.trackSoundVersion = playingTrackSound[track]->version;
+            }
+            else
+            {
+                return; // nothing rendered for it yet
+            }
+        }
         voice.position = 0;
-        voice.accented = (event.velocity >= 0.95f);
-        voice.gain = event.velocity * accentMultiplier(event.instrument, voice.accented);
+        if (voice.variant >= 0)
+            synthWorker.retain(voice.variant);
+        voice.accented = event.accent || (event.velocity >= 0.95f);
+        voice.gain = event.velocity * accentMultiplier(model, voice.accented);
 
-        if (voice.accented && event.instrument == Instrument::Kick)
+        if (voice.accented && model == Instrument::Kick)
             kickThumpEnv = juce::jmax(kickThumpEnv, 0.55f + accentLevel * 0.65f);
 
-        voices[(int)event.instrument].add(voice);
+        voices[track].add(voice);
+        soundingTracks |= (juce::uint64)1 << track;
+        if (voice.sample->data.getNumChannels() > 1)
+            stereoTracks |= (juce::uint64)1 << track;
     }
 
-    void Engine::applyAutomationForStep(Instrument instrument, int stepIndex)
+    void Engine::applyAutomation(const StepEvent& event)
     {
-        if (stepIndex < 0 || stepIndex >= 16)
+        if (event.automationMask == 0)
             return;
 
-        auto& seq = getSequencer();
-        auto& ch = channels[(int)instrument];
+        if (!tracks.isActive(event.track))
+            return;
 
-        float value = 0.0f;
-        bool needsResynth = false;
+        auto& ch = channels[event.track.index];
+        if ((event.automationMask & (1 << (int)AutomationParam::Level)) != 0)
+            ch.level = event.automation[(int)AutomationParam::Level];
 
-        if (seq.getAutomationPoint(instrument, AutomationParam::Level, stepIndex, value))
-            ch.level = value;
-        if (seq.getAutomationPoint(instrument, AutomationParam::Tune, stepIndex, value))
-        {
-            ch.params.tune = value;
-            needsResynth = true;
-        }
-        if (seq.getAutomationPoint(instrument, AutomationParam::Decay, stepIndex, value))
+        if (applySoundAutomation(ch.params, event))
+            selectTrackSound(event);
+    }
+
+    void Engine::prefetchAutomation()
+    {
+        upcomingAutomation.clearQuick();
+        for (const auto& scheduled : scheduledEvents)
+            if (scheduled.event.automationMask != 0)
+                upcomingAutomation.add(scheduled.event);
+        if (const int skipped = sequencer.collectUpcomingAutomation(upcomingAutomation))
+            skippedPrefetches.fetch_add(skipped, std::memory_order_relaxed);
+
+        // Walk the automation in playing order from the channels' current settings, so each
+        // trig is rendered with what the trigs before it will have left on the channel.
+        // Requests for sounds already queued or rendered cost a lookup.
+        juce::uint64 predicted = 0;
+        for (const auto& event : upcomingAutomation)
         {
-            ch.params.decay = value;
-            needsResynth = true;
+            if (!tracks.isActive(event.track) || tracks.getSource(event.track) != TrackSource::Model)
+                continue;
+
+            const int track = event.track.index;
+            const auto bit = (juce::uint64)1 << track;
+            if ((predicted & bit) == 0)
+            {
+                predictedParams[track] = channels[track].params;
+                predicted |= bit;
+            }
+
+            if (applySoundAutomation(predictedParams[track], event) && findPrebuiltSound(event, predictedParams[track]) < 0)
+                synthWorker.request(track, tracks.getModel(event.track), predictedParams[track]);
         }
-        if (seq.getAutomationPoint(instrument, AutomationParam::Tone, stepIndex, value))
+    }
+
+    int Engine::findPrebuiltSound(const StepEvent& event, const InstrumentParams& params) const
+    {
+        if (playingSounds == nullptr || playingSounds->sampleRate != sampleRate)
+            return -1;
+
+        return playingSounds->find(event.track.index, event.stepIndex, tracks.getModel(event.track), params);
+    }
+
+    void Engine::selectTrackSound(const StepEvent& event)
+    {
+        const auto track = event.track;
+        const int index = track.index;
+        if (tracks.getSource(track) != TrackSource::Model)
+            return;
+
+        const int variant = findPrebuiltSound(event, channels[index].params);
+        if (variant >= 0)
         {
-            ch.params.tone = value;
-            needsResynth = true;
+            setTrackVariant(index, -1);
+            prebuiltSound[index] = &playingSounds->variants.getReference(variant).sample;
+            prebuiltVersion[index] = playingSounds->version;
+            return;
         }
-        if (seq.getAutomationPoint(instrument, AutomationParam::Snappy, stepIndex, value))
+
+        const auto model = tracks.getModel(track);
+        const int slot = synthWorker.find(index, model, channels[index].params);
+        if (slot >= 0)
         {
-            ch.params.snappy = value;
-            needsResynth = true;
+            setTrackVariant(index, slot);
+            return;
         }
 
-        if (needsResynth)
-            updateInstrumentSound(instrument);
+        // Not rendered ahead, because the pattern or a knob changed inside the lookahead. The
+        // track keeps its last sound and the render is queued; the first trig after the worker
+        // has finished it picks it up.
+        synthWorker.request(index, model, channels[index].params);
+        awaitingVariant |= (juce::uint64)1 << index;
+    }
+
+    void Engine::pickUpQueuedSound(int track)
+    {
+        const auto model = tracks.getModel(TrackId(track));
+        const int slot = synthWorker.find(track, model, channels[track].params);
+        if (slot >= 0)
+            setTrackVariant(track, slot);
+        else
+            synthWorker.request(track, model, channels[track].params); // in case every slot was busy last time
+    }
+
+    void Engine::setTrackVariant(int track, int slot)
+    {
+        awaitingVariant &= ~((juce::uint64)1 << track);
+        prebuiltSound[track] = nullptr;
+        prebuiltVersion[track] = 0;
+
+        if (trackVariant[track] == slot)
+            return;
+
+        if (slot >= 0)
+            synthWorker.retain(slot);
+        if (trackVariant[track] >= 0)
+            synthWorker.release(trackVariant[track]);
+        trackVariant[track] = slot;
     }
 
-    void Engine::clearVoices(Instrument instrument)
+    void Engine::clearVoices(TrackId track)
     {
-        voices[(int)instrument].clearQuick();
+        for (const auto& voice : voices[track.index])
+            if (voice.variant >= 0)
+                synthWorker.release(voice.variant);
+        voices[track.index].clearQuick();
     }
 
     void Engine::setupDelay(double newSampleRate)
@@ -253,13 +1075,13 @@ namespace rb338
         delayWritePos = 0;
     }
 
-    float Engine::accentMultiplier(Instrument instrument, bool accented) const
+    float Engine::accentMultiplier(Instrument model, bool accented) const
     {
         if (!accented)
             return 1.0f;
 
         float boost = 1.0f + accentLevel * 0.35f;
-        switch (instrument)
+        switch (model)
         {
             case Instrument::Kick:      boost = 1.0f + accentLevel * 0.72f; break;
             case Instrument::Snare:     boost = 1.0f + accentLevel * 0.42f; break;
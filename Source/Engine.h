@@ -1,8 +1,13 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "MidiClock.h"
+#include "PatternIO.h"
+#include "SampleKit.h"
 #include "Samples.h"
 #include "Sequencer.h"
+#include "SynthWorker.h"
+#include "Tracks.h"
 
 namespace rb338
 {
@@ -14,24 +19,108 @@ namespace rb338
         InstrumentParams params; // TR-909 voice parameters
     };
 
+    // A live hit, knob move or tempo change captured while recording, placed on the transport
+    // where the player heard it.
+    struct RecordedEvent
+    {
+        enum class Type
+        {
+            Hit = 0,
+            Automation,
+            Tempo
+        };
+
+        Type type = Type::Hit;
+        TrackId track;
+        AutomationParam param = AutomationParam::Level;
+        float value = 0.0f; // velocity, parameter value or BPM
+        bool accent = false;
+        double phase = 0.0; // transport steps on the ideal grid
+    };
+
     class Engine
     {
     public:
+        Engine();
+
         void prepare(double sampleRate, int samplesPerBlock, int numOutputs);
+        void release(); // once the device has stopped calling render
         void render(juce::AudioBuffer<float>& buffer, int numSamples);
-        void triggerInstrument(Instrument instrument, float velocity = 1.0f);
+        void triggerInstrument(TrackId track, float velocity = 1.0f);
 
         void setBpm(float bpm);
         void setRunning(bool running);
+        void continuePlayback();
         bool isRunning() const;
         void setAccentLevel(float level); // 0-1 range, controls accent volume boost
         float getAccentLevel() const;
 
+        // MIDI note input. The collector is fed by the device manager; notes are played at
+        // their timestamped position inside the next block, so jitter stays under one buffer.
+        juce::MidiMessageCollector& getMidiCollector();
+        void setMidiNoteMapping(int note, TrackId track); // an invalid track unmaps the note
+        TrackId getMidiNoteMapping(int note) const; // index -1 when unmapped
+        void learnMidiNote(TrackId track); // the next incoming note gets mapped to track
+        void setMidiAccentThreshold(int velocity); // notes at or above this velocity play accented
+
+        // MIDI clock. The output sends 24 ppq clock plus Start / Stop / Continue, placed on the
+        // transport's own grid. With external sync on, clock from the inputs drives the transport.
+        void setMidiClockOutput(std::unique_ptr<juce::MidiOutput> output);
+        void setExternalClockSync(bool shouldSync);
+        bool isExternalClockSync() const;
+        bool isExternalClockLocked() const;
+
+        // Hits dropped since prepare because a block had more than its preallocated room:
+        // sequencer hits past Sequencer::maxScheduledEvents, notes past maxMidiNotesPerBlock.
+        int getDroppedEvents() const;
+
+        // Automated trigs since prepare that were not rendered ahead because the lookahead held
+        // more than Sequencer::maxUpcomingAutomation of them. Their sounds are queued when they play.
+        int getSkippedPrefetches() const;
+
+        // Live recording. While armed and running, hits from triggerInstrument and MIDI, and the
+        // moves passed to recordAutomation / recordTempo, are stamped on arrival and shifted back
+        // by the output latency. The message thread collects them with popRecordedEvent.
+        void setRecording(bool shouldRecord);
+        void setOutputLatency(int samples); // device latency plus one buffer
+        void recordAutomation(TrackId track, AutomationParam param, float value);
+        void recordTempo(float bpm);
+        bool popRecordedEvent(RecordedEvent& event);
+
         Sequencer& getSequencer();
         SampleLibrary& getSampleLibrary();
 
-        MixerChannel& getChannel(Instrument instrument);
-        void updateInstrumentSound(Instrument instrument);
+        // Tracks beyond the built-in kit, up to maxTracks. A model track runs its own copy of a
+        // kit voice with its own mixer channel; a sample track plays a file and borrows a model's
+        // accent response. Both return the new track, or -1 when no slot is free or the file
+        // cannot be read. Removing a track unmaps its MIDI notes and lets its voices ring out;
+        // its pattern lanes are left for the caller to clear.
+        const TrackRegistry& getTracks() const;
+        int addModelTrack(Instrument model, const juce::String& name);
+        int addSampleTrack(const juce::File& file, Instrument borrowedModel = Instrument::Rim);
+        void removeTrack(TrackId track);
+
+        MixerChannel& getChannel(TrackId track);
+        void updateInstrumentSound(TrackId track); // after changing the channel's params outside the pattern
+
+        // Message thread. Once the library has loaded the reference pack in the background, moves
+        // it in and renders the sounds that layer it again; true if any changed.
+        bool installReferencePack();
+
+        // Message thread. Kits are the .l9kit files in SampleKit's folder. Selecting one maps it
+        // and hands it to the audio thread, so switching kits mid-set is a pointer swap; only the
+        // first selection at a new device rate converts it (see SampleKit::openAt). Its sounds
+        // then play on the built-in tracks it covers in place of their synthesised voices.
+        // An empty file goes back to the synthesised kit. Returns false, keeping the current
+        // kit, if the file is not a kit. A replaced kit is unmapped once nothing plays from it.
+        juce::Array<juce::File> listKits() const;
+        bool selectKit(const juce::File& file);
+        const SampleKit& getSelectedKit() const;
+
+        // Message thread, when a pattern is loaded as the main pattern. Works out every sound its
+        // automation will play from the channels' current settings, renders them in parallel and
+        // binds each automated trig to its sound, so looping it is plain sample playback.
+        void loadPatternSounds(const PatternGrid& pattern, int length);
 
     private:
         struct VoiceInstance
@@ -40,6 +129,26 @@ namespace rb338
             int position = 0;
             float gain = 1.0f;
             bool accented = false;
+            int variant = -1; // synth worker slot, when playing a sound rendered ahead
+            juce::uint64 soundsVersion = 0; // pattern sounds it plays from, or 0
+            juce::uint64 kitVersion = 0; // kit it plays from, or 0
+            juce::uint64 trackSoundVersion = 0; // track sound it plays from, or 0
+        };
+
+        // A track's own sound, for when no variant or kit sound covers it. A new render is
+        // published next to the old one, never over it. The audio thread reports per track the
+        // oldest one it or a ringing voice still plays, and older ones are freed on the next publish.
+        struct TrackSound
+        {
+            Sample sample;
+            juce::uint64 version = 0;
+        };
+
+        struct TrackSoundSlot
+        {
+            juce::OwnedArray<TrackSound> sounds;
+            std::atomic<TrackSound*> published { nullptr };
+            std::atomic<juce::uint64> inUse { 0 };
         };
 
         double sampleRate = 44100.0;
@@ -47,8 +156,56 @@ namespace rb338
         Sequencer sequencer;
         float accentLevel = 0.5f; // TR-909 style accent control (0-1)
 
-        juce::Array<VoiceInstance> voices[(int)Instrument::Count];
-        MixerChannel channels[(int)Instrument::Count];
+        TrackRegistry tracks;
+        TrackSoundSlot trackSounds[maxTracks];
+        juce::uint64 nextTrackSoundVersion = 1;
+        const TrackSound* playingTrackSound[maxTracks] = {}; // audio thread, as of the block start
+        juce::Array<VoiceInstance> voices[maxTracks];
+        MixerChannel channels[maxTracks];
+        juce::uint64 soundingTracks = 0; // tracks with voices still playing
+        juce::uint64 stereoTracks = 0; // sounding tracks that have played a stereo voice since they were last silent
+
+        // Automated sounds are rendered ahead on the synth worker. A track plays its worker
+        // variant while it has one, and otherwise its track sound; nothing is rendered on the
+        // audio thread.
+        SynthWorker synthWorker { sampleLibrary };
+        int trackVariant[maxTracks];
+        juce::uint64 awaitingVariant = 0; // tracks whose sound for their current settings is still queued
+        InstrumentParams predictedParams[maxTracks];
+        juce::Array<StepEvent> upcomingAutomation;
+        std::atomic<int> skippedPrefetches { 0 };
+        std::atomic<juce::uint64> soundsChanged { 0 }; // tracks re-rendered from the message thread
+
+        // Sounds prebuilt for the main pattern take precedence over worker variants. The audio
+        // thread reports the oldest table a track or a ringing voice still plays from, and the
+        // message thread frees older ones on the next load.
+        juce::OwnedArray<PatternSounds> patternSounds;
+        juce::uint64 nextSoundsVersion = 1;
+        std::atomic<PatternSounds*> publishedSounds { nullptr };
+        std::atomic<juce::uint64> soundsInUse { 0 };
+        const PatternSounds* playingSounds = nullptr;
+        const Sample* prebuiltSound[maxTracks] = {};
+        juce::uint64 prebuiltVersion[maxTracks] = {};
+
+        // The selected kit takes precedence over everything above on the tracks it covers, and
+        // replaced kits are released the same way as pattern sounds.
+        juce::OwnedArray<SampleKit> kits;
+        juce::uint64 nextKitVersion = 1;
+        std::atomic<SampleKit*> publishedKit { nullptr };
+        std::atomic<juce::uint64> kitsInUse { 0 };
+        const SampleKit* playingKit = nullptr;
+
+        // Per-track gains, worked out from the mixer channels once per block and kept in flat
+        // arrays so the mix is a run of vector multiply-adds over the tracks that are sounding.
+        struct TrackMix
+        {
+            float gainLeft[maxTracks] = {};
+            float gainRight[maxTracks] = {};
+            float send[maxTracks] = {};
+        };
+
+        TrackMix trackMix;
+        juce::AudioBuffer<float> mixBus; // left, right, delay send and one track's scratch left and right
 
         juce::AudioBuffer<float> delayBuffer;
         int delayWritePos = 0;
@@ -57,15 +214,66 @@ namespace rb338
         float delayMix = 0.08f;        // Reduced from 0.2 (subtle effect)
         float kickThumpEnv = 0.0f;
         float kickThumpPhase = 0.0f;
+        // Input from the message thread, stamped with its arrival time. The two arrays swap each
+        // block so neither side allocates once both have grown.
+        struct LiveInput
+        {
+            RecordedEvent record;
+            double arrivalMs = 0.0;
+        };
+
         juce::SpinLock pendingTriggerLock;
-        juce::Array<StepEvent> pendingTriggers;
+        juce::Array<LiveInput> pendingTriggers;
+        juce::Array<LiveInput> liveInputs;
+
+        static constexpr int recordQueueSize = 512;
+        std::atomic<bool> recordArmed { false };
+        std::atomic<int> outputLatencySamples { 0 };
+        juce::AbstractFifo recordQueue { recordQueueSize };
+        std::array<RecordedEvent, recordQueueSize> recordedEvents;
+        static constexpr int maxMidiNotesPerBlock = 128;
+        juce::Array<ScheduledEvent> scheduledEvents;
+        std::atomic<int> droppedNotes { 0 };
+
+        juce::MidiMessageCollector midiCollector;
+        juce::MidiBuffer midiInput;
+        std::atomic<int> midiNoteMap[128];
+        std::atomic<int> midiLearnTarget { -1 };
+        std::atomic<int> midiAccentThreshold { 100 };
+
+        MidiClockFollower clockFollower;
+        std::atomic<bool> clockLocked { false };
+        bool clockAnchored = false; // the master's song position is known, not just its tempo
+        juce::int64 stoppedAtPulse = 0;
+        juce::int64 renderedSamples = 0;
+        juce::Array<ClockMessage> clockMessages;
+        MidiClockSender clockSender;
+        double midiOutputLatencyMs = 0.0;
 
-        float renderInstrument(Instrument instrument);
+        void postLiveInput(const RecordedEvent& record);
+        void captureLiveInput(RecordedEvent record, double offset);
+        void followMidiClock(int numSamples);
+        void sendMidiClock();
+        void mergeMidiInput(int numSamples);
+        void renderRange(juce::AudioBuffer<float>& buffer, int startSample, int endSample);
+        void updateTrackMix();
+        void renderTrack(int track, float* left, float* right, int numSamples); // right is null for a mono track
+        void renderTrackSound(TrackId track);
+        void publishTrackSound(int track, Sample sound);
+        void acknowledgeTrackSounds();
+        void prefetchAutomation();
+        int findPrebuiltSound(const StepEvent& event, const InstrumentParams& params) const;
+        void selectTrackSound(const StepEvent& event);
+        void pickUpQueuedSound(int track);
+        void setTrackVariant(int track, int slot);
+        void acknowledgePatternSounds();
+        void publishKit(std::unique_ptr<SampleKit> kit);
+        void acknowledgeKit();
         void triggerVoice(const StepEvent& event);
-        void applyAutomationForStep(Instrument instrument, int stepIndex);
-        void clearVoices(Instrument instrument);
+        void applyAutomation(const StepEvent& event);
+        void clearVoices(TrackId track);
         void setupDelay(double sampleRate);
-        float accentMultiplier(Instrument instrument, bool accented) const;
+        float accentMultiplier(Instrument model, bool accented) const;
         float safeSaturate(float x, float drive) const;
     };
 }
@@ -1,7 +1,9 @@
 #include <JuceHeader.h>
 #include <array>
+#include <iostream>
 #include <optional>
 #include "Engine.h"
+#include "PatternIO.h"
 #include "Sequencer.h"
 
 namespace rb338
@@ -155,18 +157,7 @@ namespace rb338
     };
     static constexpr int numGridRows = 11;
     static constexpr int numBanks = 2;
-    static constexpr int numPatternsPerBank = 16;
-
-    struct PatternData
-    {
-        StepState steps[(int)Instrument::Count][16] {};
-        bool automationActive[(int)Instrument::Count][(int)AutomationParam::Count][16] {};
-        float automationValue[(int)Instrument::Count][(int)AutomationParam::Count][16] {};
-        float bpm = 120.0f;
-        float shuffle = 0.0f;
-        float accent = 0.5f;
-        juce::String name;
-    };
+    static constexpr int numPatternsPerBank = PatternIO::patternsPerBank;
 
     // =========================================================================
     // Knob definition for instrument sections
@@ -442,6 +433,7 @@ namespace rb338
     public:
         std::function<void()> onRequestPatternManager;
         std::function<void(float)> onBpmChanged;
+        std::function<void()> onClearTempoAutomation;
 
         LCDDisplay(Engine& e) : engine(e)
         {
@@ -533,7 +525,7 @@ namespace rb338
 
             g.drawText(id, patternArea, juce::Justification::centredLeft, false);
 
-            float bpm = currentBpm;
+            float bpm = engine.isRunning() ? engine.getSequencer().getCurrentBpm() : currentBpm;
             auto bpmLabelArea = bpmArea.removeFromLeft(26);
             g.setColour(Clr::lcdDim);
             g.setFont(juce::Font(juce::Font::getDefaultMonospacedFontName(), 10.0f, juce::Font::bold));
@@ -588,6 +580,17 @@ namespace rb338
 
         void mouseDown(const juce::MouseEvent& e) override
         {
+            if (e.mods.isPopupMenu() && e.mods.isShiftDown() && e.x < getWidth() - 120)
+            {
+                showTempoRampDialog();
+                return;
+            }
+            if (e.mods.isAltDown() && e.x < getWidth() - 120)
+            {
+                if (onClearTempoAutomation)
+                    onClearTempoAutomation();
+                return;
+            }
             if (e.mods.isPopupMenu() && e.x < getWidth() - 120)
             {
                 if (onRequestPatternManager)
@@ -608,6 +611,38 @@ namespace rb338
         int patternIndex = 0;
         juce::String patternName;
 
+        void showTempoRampDialog()
+        {
+            auto* window = new juce::AlertWindow("Tempo Ramp", "Glide from the current tempo to a new one.", juce::AlertWindow::NoIcon);
+            window->addTextEditor("bpm", juce::String(currentBpm, 1), "Target BPM");
+            window->addComboBox("bars", { "1 bar", "2 bars", "4 bars", "8 bars", "16 bars" }, "Length");
+            window->addComboBox("curve", { "Linear", "Exponential" }, "Curve");
+            window->getComboBoxComponent("bars")->setSelectedItemIndex(2);
+            window->getComboBoxComponent("curve")->setSelectedItemIndex(0);
+            window->addButton("Ramp", 1, juce::KeyPress(juce::KeyPress::returnKey));
+            window->addButton("Cancel", 0, juce::KeyPress(juce::KeyPress::escapeKey));
+
+            juce::Component::SafePointer<LCDDisplay> safeThis(this);
+            window->enterModalState(true, juce::ModalCallbackFunction::create([safeThis, window](int result)
+            {
+                if (result != 1 || safeThis == nullptr)
+                    return;
+
+                const float target = window->getTextEditorContents("bpm").getFloatValue();
+                const int bars = 1 << window->getComboBoxComponent("bars")->getSelectedItemIndex();
+                const auto curve = window->getComboBoxComponent("curve")->getSelectedItemIndex() == 1
+                    ? TempoCurve::Exponential : TempoCurve::Linear;
+                safeThis->startTempoRamp(target, bars, curve);
+            }), true);
+        }
+
+        void startTempoRamp(float targetBpm, int bars, TempoCurve curve)
+        {
+            currentBpm = juce::jlimit(60.0f, 180.0f, targetBpm);
+            engine.getSequencer().rampToBpm(currentBpm, bars * 16, curve);
+            repaint();
+        }
+
         void sliderValueChanged(juce::Slider* slider) override
         {
             if (slider == &shuffleSlider)
@@ -799,7 +834,9 @@ namespace rb338
                 g.setFont(juce::Font(9.0f, juce::Font::bold));
                 g.drawText(gridRows[row].label, 1, y, 22, rowH, juce::Justification::centred, false);
 
-                const bool hasAutomation = engine.getSequencer().hasAutomation(inst);
+                const auto& pattern = engine.getSequencer().getPattern();
+                const bool hasAutomation = pattern.hasAutomation(inst);
+                const auto& lanes = pattern.getLanes(inst);
                 auto nilBounds = getNilBoundsForRow(row).toFloat();
                 g.setColour(hasAutomation ? Clr::orange : juce::Colour(0xff777777));
                 g.fillRoundedRectangle(nilBounds, 2.0f);
@@ -817,19 +854,34 @@ namespace rb338
                 for (int col = 0; col < 16; ++col)
                 {
                     int cx = labelW + col * cellW;
-                    auto state = engine.getSequencer().getStep(inst, col);
+                    const auto bit = StepBits::bit(col);
 
-                    if (state == StepState::On)
+                    if ((lanes.accent & bit) != 0)
+                    {
+                        g.setColour(Clr::cellAccent);
+                        g.fillRect(cx + 1, y + 1, cellW - 2, rowH - 2);
+                    }
+                    else if ((lanes.on & bit) != 0)
                     {
                         g.setColour(Clr::cellActive);
                         g.fillRect(cx + 1, y + 1, cellW - 2, rowH - 2);
                         g.setColour(juce::Colours::white.withAlpha(0.25f));
                         g.fillRect(cx + 3, y + 3, cellW - 6, (rowH - 6) / 2);
                     }
-                    else if (state == StepState::Accent)
+
+                    if ((lanes.flam & bit) != 0)
                     {
-                        g.setColour(Clr::cellAccent);
-                        g.fillRect(cx + 1, y + 1, cellW - 2, rowH - 2);
+                        g.setColour(Clr::textWhite.withAlpha(0.8f));
+                        g.fillRect(cx + 3, y + 4, 2, rowH - 8);
+                        g.fillRect(cx + 7, y + 4, 2, rowH - 8);
+                    }
+
+                    const float offset = pattern.getMicrotiming(inst, col);
+                    if ((lanes.on & bit) != 0 && offset != 0.0f)
+                    {
+                        const float tickX = (float)cx + cellW * (0.5f + offset);
+                        g.setColour(Clr::textDark);
+                        g.fillRect(tickX - 1.0f, (float)(y + rowH - 6), 2.0f, 4.0f);
                     }
 
                     // Current step highlight
@@ -886,6 +938,26 @@ namespace rb338
 
             if (col >= 0 && col < 16)
             {
+                auto& seq = engine.getSequencer();
+                auto inst = gridRows[row].instrument;
+                const bool stepOn = seq.getStep(inst, col) != StepState::Off;
+
+                // Alt-click toggles a flam, shift-drag nudges the trig off the grid.
+                if (stepOn && e.mods.isAltDown())
+                {
+                    seq.setFlam(inst, col, !seq.getFlam(inst, col));
+                    repaint();
+                    return;
+                }
+
+                if (stepOn && e.mods.isShiftDown())
+                {
+                    nudgeInstrument = inst;
+                    nudgeCol = col;
+                    updateNudge(e.x);
+                    return;
+                }
+
                 dragInstrument = gridRows[row].instrument;
                 dragLastCol = col;
 
@@ -902,6 +974,12 @@ namespace rb338
         
         void mouseDrag(const juce::MouseEvent& e) override
         {
+            if (nudgeCol >= 0)
+            {
+                updateNudge(e.x);
+                return;
+            }
+
             if (dragInstrument == Instrument::Count) return;
             
             int col = (e.x - labelW) / cellW;
@@ -912,6 +990,7 @@ namespace rb338
                 int start = juce::jmin(dragLastCol, col);
                 int end = juce::jmax(dragLastCol, col);
                 
+                Sequencer::ScopedEdit edit(engine.getSequencer());
                 for (int c = start; c <= end; ++c)
                 {
                     engine.getSequencer().setStep(dragInstrument, c, dragPaintState);
@@ -926,6 +1005,8 @@ namespace rb338
         {
             dragInstrument = Instrument::Count;
             dragLastCol = -1;
+            nudgeInstrument = Instrument::Count;
+            nudgeCol = -1;
         }
 
     private:
@@ -940,6 +1021,22 @@ namespace rb338
         int dragLastCol = -1;
         StepState dragPaintState = StepState::Off;
 
+        // Microtiming drag state
+        Instrument nudgeInstrument = Instrument::Count;
+        int nudgeCol = -1;
+
+        void updateNudge(int mouseX)
+        {
+            const float centreX = (float)(labelW + nudgeCol * cellW) + cellW * 0.5f;
+            const float offset = juce::jlimit(-0.5f, 0.5f, ((float)mouseX - centreX) / (float)cellW);
+            const float nudge = std::abs(offset) < 0.04f ? 0.0f : offset;
+            if (nudge == engine.getSequencer().getMicrotiming(nudgeInstrument, nudgeCol))
+                return;
+
+            engine.getSequencer().setMicrotiming(nudgeInstrument, nudgeCol, nudge);
+            repaint();
+        }
+
         juce::Rectangle<int> getNilBoundsForRow(int row) const
         {
             return { 24, row * rowH + 3, 22, rowH - 6 };
@@ -1151,6 +1248,7 @@ public:
             int start = juce::jmin(dragLastCol, col);
             int end = juce::jmax(dragLastCol, col);
 
+            Sequencer::ScopedEdit edit(engine.getSequencer());
             for (int c = start; c <= end; ++c)
             {
                 engine.getSequencer().setStep(currentInstrument, c, dragPaintState);
@@ -1244,7 +1342,11 @@ public:
         std::function<void(int, int)> onPastePattern;
         std::function<void(int, int)> onDeletePattern;
         std::function<void(int, int)> onRandomizePattern;
+        std::function<void(int, int)> onLayerPattern;
         std::function<void(int)> onSaveBank;
+        std::function<void(int, int)> onExportPattern;
+        std::function<void(int)> onExportBank;
+        std::function<void(int, int)> onImportMidi;
         std::function<void()> onClose;
 
         PatternManagerOverlay()
@@ -1260,8 +1362,12 @@ public:
             setupButton(pasteButton, "PASTE");
             setupButton(deleteButton, "DELETE");
             setupButton(randomButton, "RANDOM");
+            setupButton(layerButton, "LAYER");
             setupButton(saveButton, "SAVE BANK");
             setupButton(renameButton, "RENAME");
+            setupButton(exportPatternButton, "MIDI PATT");
+            setupButton(exportBankButton, "MIDI BANK");
+            setupButton(importButton, "IMPORT MIDI");
 
             addAndMakeVisible(nameEditor);
             nameEditor.setTextToShowWhenEmpty("Pattern name", Clr::textLight);
@@ -1331,6 +1437,10 @@ public:
 
             auto actionRow2 = controls.removeFromTop(34);
             randomButton.setBounds(actionRow2.removeFromLeft(110).reduced(2));
+            layerButton.setBounds(actionRow2.removeFromLeft(110).reduced(2));
+            exportPatternButton.setBounds(actionRow2.removeFromLeft(110).reduced(2));
+            exportBankButton.setBounds(actionRow2.removeFromLeft(110).reduced(2));
+            importButton.setBounds(actionRow2.removeFromLeft(120).reduced(2));
 
             auto grid = panel.reduced(8);
             const int cols = 8;
@@ -1348,7 +1458,8 @@ public:
     private:
         juce::Label titleLabel;
         juce::TextButton closeButton, bankAButton, bankBButton;
-        juce::TextButton copyButton, pasteButton, deleteButton, randomButton, saveButton, renameButton;
+        juce::TextButton copyButton, pasteButton, deleteButton, randomButton, layerButton, saveButton, renameButton;
+        juce::TextButton exportPatternButton, exportBankButton, importButton;
         juce::TextEditor nameEditor;
         juce::OwnedArray<juce::TextButton> patternButtons;
         std::array<std::array<juce::String, numPatternsPerBank>, numBanks> patternNames {};
@@ -1429,12 +1540,36 @@ public:
                 return;
             }
 
+            if (b == &layerButton)
+            {
+                if (onLayerPattern) onLayerPattern(selectedBank, selectedPattern);
+                return;
+            }
+
             if (b == &saveButton)
             {
                 if (onSaveBank) onSaveBank(selectedBank);
                 return;
             }
 
+            if (b == &exportPatternButton)
+            {
+                if (onExportPattern) onExportPattern(selectedBank, selectedPattern);
+                return;
+            }
+
+            if (b == &exportBankButton)
+            {
+                if (onExportBank) onExportBank(selectedBank);
+                return;
+            }
+
+            if (b == &importButton)
+            {
+                if (onImportMidi) onImportMidi(selectedBank, selectedPattern);
+                return;
+            }
+
             if (b == &renameButton)
             {
                 if (onRenamePattern) onRenamePattern(selectedBank, selectedPattern, nameEditor.getText().trim());
@@ -1457,7 +1592,7 @@ public:
     // =========================================================================
     // Main Component
     // =========================================================================
-    class MainComponent : public juce::AudioAppComponent, private juce::Timer
+    class MainComponent : public juce::AudioAppComponent, public juce::FileDragAndDropTarget, private juce::Timer
     {
     public:
         MainComponent()
@@ -1473,7 +1608,17 @@ public:
             lcd->onRequestPatternManager = [this]() { showPatternManager(true); };
             lcd->onBpmChanged = [this](float bpm)
             {
-                juce::ignoreUnused(bpm);
+                // Moving the tempo while recording writes tempo automation on the current step.
+                if (recordingEnabled && engine.isRunning() && !isApplyingPattern)
+                    engine.recordTempo(bpm);
+                updateCurrentPatternFromEngine();
+            };
+            lcd->onClearTempoAutomation = [this]()
+            {
+                if (!engine.getSequencer().hasTempoAutomation())
+                    return;
+                engine.getSequencer().clearTempoAutomation();
+                hasUserPatternChanges = true;
                 updateCurrentPatternFromEngine();
             };
 
@@ -1570,18 +1715,51 @@ public:
                 selectPattern(bank, pattern, true);
                 updatePatternManagerNames();
             };
+            patternManager->onLayerPattern = [this](int bank, int pattern)
+            {
+                toggleLayer(bank, pattern);
+            };
             patternManager->onSaveBank = [this](int)
             {
                 hasUserPatternChanges = true;
                 savePatternBanksToDisk();
             };
+            patternManager->onExportPattern = [this](int bank, int pattern)
+            {
+                saveCurrentPatternSlot();
+                exportMidi(collectPatterns(bank * numPatternsPerBank + pattern, 1), patterns[(size_t)bank][(size_t)pattern].name);
+            };
+            patternManager->onExportBank = [this](int bank)
+            {
+                saveCurrentPatternSlot();
+                exportMidi(collectPatterns(bank * numPatternsPerBank, numPatternsPerBank),
+                           "Bank " + juce::String::charToString((juce_wchar)('A' + bank)));
+            };
+            patternManager->onImportMidi = [this](int bank, int pattern)
+            {
+                importMidi(bank, pattern);
+            };
             addChildComponent(*patternManager);
 
             selectPattern(currentBank, currentPattern, true);
 
             setSize(windowW, collapsedHeight);
             startTimerHz(30);
+
+            // Before the first prepare, so the kit is only ever rendered at one quality.
+            if (juce::SystemStats::getEnvironmentVariable("LOS9X9_OSCILLATORS", {}).equalsIgnoreCase("naive"))
+                engine.getSampleLibrary().setOscillatorQuality(OscillatorQuality::Naive);
+
             setAudioChannels(0, 2);
+
+            // MIDI pads: listen on every input that is present at startup.
+            for (const auto& input : juce::MidiInput::getAvailableDevices())
+                deviceManager.setMidiInputDeviceEnabled(input.identifier, true);
+            deviceManager.addMidiInputDeviceCallback({}, &engine.getMidiCollector());
+
+            // MIDI clock goes out on the default output, if there is one.
+            if (auto output = juce::MidiOutput::openDevice(juce::MidiOutput::getDefaultDevice().identifier))
+                engine.setMidiClockOutput(std::move(output));
         }
 
         ~MainComponent() override
@@ -1590,12 +1768,19 @@ public:
             if (hasLoadedPatternBanks || hasUserPatternChanges)
                 savePatternBanksToDisk();
             setLookAndFeel(nullptr);
+            deviceManager.removeMidiInputDeviceCallback({}, &engine.getMidiCollector());
             shutdownAudio();
         }
 
         void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
         {
             engine.prepare(sampleRate, samplesPerBlockExpected, 2);
+
+            int outputLatency = samplesPerBlockExpected;
+            if (auto* device = deviceManager.getCurrentAudioDevice())
+                outputLatency += device->getOutputLatencyInSamples();
+            engine.setOutputLatency(outputLatency);
+
             engine.getSequencer().setLength(16);
             applyPattern(patterns[(size_t)currentBank][(size_t)currentPattern]);
         }
@@ -1605,7 +1790,10 @@ public:
             engine.render(*bufferToFill.buffer, bufferToFill.numSamples);
         }
 
-        void releaseResources() override {}
+        void releaseResources() override
+        {
+            engine.release();
+        }
 
         int getExpandedHeightForWindow() const { return expandedHeight(); }
 
@@ -1721,6 +1909,21 @@ public:
             auto statusText = engine.isRunning()
                 ? juce::String("SYSTEM ACTIVE - INTERNAL CLOCK SYNCED")
                 : juce::String("SYSTEM IDLE - WAITING FOR MIDI CLOCK...");
+            if (engine.isExternalClockSync())
+            {
+                statusText = engine.isExternalClockLocked()
+                    ? "EXTERNAL CLOCK LOCKED - " + juce::String(engine.getSequencer().getCurrentBpm(), 1) + " BPM"
+                    : juce::String("EXTERNAL CLOCK - WAITING FOR MIDI CLOCK...");
+            }
+            if (engine.getSelectedKit().getFile() != juce::File())
+                statusText = "KIT " + engine.getSelectedKit().getName().toUpperCase() + " - " + statusText;
+            if (engine.getDroppedEvents() > 0)
+                statusText = "OVERLOAD - " + juce::String(engine.getDroppedEvents()) + " HITS DROPPED";
+            const auto layers = describeLayers();
+            if (layers.isNotEmpty())
+                statusText = layers;
+            if (recordingEnabled)
+                statusText = "REC - QUANTISE " + juce::String(juce::roundToInt(recordQuantise * 100.0f)) + "%";
             g.drawText(statusText, (int)(statusRect.getX() + 44), (int)statusRect.getY(),
                        (int)(statusRect.getWidth() - 66), (int)statusRect.getHeight(),
                        juce::Justification::centredLeft, false);
@@ -1845,11 +2048,56 @@ public:
                 patternManager->setBounds(getLocalBounds());
         }
 
+        bool isInterestedInFileDrag(const juce::StringArray& files) override
+        {
+            for (const auto& path : files)
+                if (juce::File(path).hasFileExtension("wav;aif;aiff;flac") || juce::File(path).isDirectory())
+                    return true;
+            return false;
+        }
+
+        // Each dropped sample becomes a track of its own; the next MIDI note played is mapped
+        // to the last one added. A dropped folder is decoded into a kit file and selected.
+        void filesDropped(const juce::StringArray& files, int, int) override
+        {
+            int added = -1;
+            for (const auto& path : files)
+            {
+                const juce::File file(path);
+                if (file.hasFileExtension("wav;aif;aiff;flac"))
+                    added = juce::jmax(added, engine.addSampleTrack(file));
+                else if (file.isDirectory())
+                {
+                    const auto kitFile = SampleKit::getDefaultDirectory().getChildFile(file.getFileName() + ".l9kit");
+                    if (SampleKit::writeFromFolder(file, kitFile))
+                        engine.selectKit(kitFile);
+                }
+            }
+
+            if (added >= 0)
+                engine.learnMidiNote(TrackId(added));
+            repaint();
+        }
+
+        // The synthesised kit, then every kit file by name, wrapping round.
+        void stepKit(int direction)
+        {
+            const auto kitFiles = engine.listKits();
+            const int count = kitFiles.size() + 1;
+            const int current = kitFiles.indexOf(engine.getSelectedKit().getFile()) + 1; // 0 is the synthesised kit
+            const int next = ((current + direction) % count + count) % count;
+            engine.selectKit(next == 0 ? juce::File() : kitFiles[next - 1]);
+            repaint();
+        }
+
         bool keyPressed(const juce::KeyPress& key) override
         {
             if (key.getKeyCode() == juce::KeyPress::spaceKey)
             {
-                engine.setRunning(!engine.isRunning());
+                if (!engine.isRunning() && key.getModifiers().isShiftDown())
+                    engine.continuePlayback();
+                else
+                    engine.setRunning(!engine.isRunning());
                 return true;
             }
 
@@ -1858,7 +2106,8 @@ public:
                 engine.triggerInstrument(inst, 1.0f);
                 selectInstrument(inst);
 
-                if (recordingEnabled)
+                // While playing, the engine records the hit itself; stopped, it toggles the step.
+                if (recordingEnabled && !engine.isRunning())
                 {
                     const int step = getRecordStepIndex();
                     const auto existing = engine.getSequencer().getStep(inst, step);
@@ -1870,6 +2119,56 @@ public:
             };
 
             const juce_wchar kc = key.getTextCharacter();
+            if (editSelectedTrack(kc))
+                return true;
+
+            if (kc >= '1' && kc < '1' + Sequencer::maxLayers - 1)
+            {
+                const int layer = (int)(kc - '1') + 1;
+                auto& seq = engine.getSequencer();
+                if (seq.isLayerActive(layer))
+                    seq.setLayerMuted(layer, !seq.isLayerMuted(layer));
+                repaint();
+                return true;
+            }
+
+            if (kc == 'n' || kc == 'N')
+            {
+                engine.learnMidiNote(selectedInstrument);
+                return true;
+            }
+
+            if (kc == 'q' || kc == 'Q')
+            {
+                recordQuantise = recordQuantise >= 1.0f ? 0.75f
+                               : recordQuantise >= 0.75f ? 0.5f
+                               : recordQuantise >= 0.5f ? 0.0f
+                               : 1.0f;
+                repaint();
+                return true;
+            }
+
+            if (kc == 'e' || kc == 'E')
+            {
+                engine.setExternalClockSync(!engine.isExternalClockSync());
+                repaint();
+                return true;
+            }
+
+            if (kc == '-' || kc == '=')
+            {
+                stepKit(kc == '=' ? 1 : -1);
+                return true;
+            }
+
+            if (kc == '[' || kc == ']')
+            {
+                auto& seq = engine.getSequencer();
+                seq.setFlamSpacing(seq.getFlamSpacing() + (kc == ']' ? 1.0f : -1.0f));
+                updateCurrentPatternFromEngine();
+                return true;
+            }
+
             switch (kc)
             {
                 case 'a':
@@ -1927,6 +2226,7 @@ public:
         Instrument selectedInstrument = Instrument::Kick;
         bool panelExpanded = false;
         bool recordingEnabled = false;
+        float recordQuantise = 1.0f; // 1 = on the step, 0 = keep the played timing as microtiming
 
         static constexpr int windowW = 686;
         static constexpr int headerH = 198;
@@ -1945,8 +2245,12 @@ public:
         std::unique_ptr<PatternManagerOverlay> patternManager;
         std::array<std::array<PatternData, numPatternsPerBank>, numBanks> patterns {};
         std::optional<PatternData> clipboardPattern;
+        std::unique_ptr<juce::FileChooser> fileChooser;
+        std::optional<PatternGrid> rowClipboard;
+        Instrument rowClipboardInstrument = Instrument::Kick;
         int currentBank = 0;
         int currentPattern = 0;
+        std::array<int, Sequencer::maxLayers> layerSlots { -1, -1, -1, -1 }; // bank * numPatternsPerBank + pattern
         bool isApplyingPattern = false;
         bool hasLoadedPatternBanks = false;
         bool hasUserPatternChanges = false;
@@ -1988,7 +2292,7 @@ public:
             auto set = [&p](Instrument inst, int step, StepState st)
             {
                 if (step >= 0 && step < 16)
-                    p.steps[(int)inst][step] = st;
+                    p.grid.setStep(inst, step, st);
             };
 
             // House/techno-informed foundations.
@@ -2025,26 +2329,12 @@ public:
             isApplyingPattern = true;
 
             auto& seq = engine.getSequencer();
-            seq.clear();
-            seq.clearAllAutomation();
             seq.setLength(16);
-            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-            {
-                for (int step = 0; step < 16; ++step)
-                {
-                    seq.setStep((Instrument)inst, step, pattern.steps[inst][step]);
-                    for (int param = 0; param < (int)AutomationParam::Count; ++param)
-                    {
-                        if (pattern.automationActive[inst][param][step])
-                        {
-                            seq.setAutomationPoint((Instrument)inst, (AutomationParam)param, step,
-                                                   pattern.automationValue[inst][param][step]);
-                        }
-                    }
-                }
-            }
+            seq.setPattern(pattern.grid);
+            engine.loadPatternSounds(pattern.grid, 16);
 
             seq.setShuffle(pattern.shuffle);
+            seq.setFlamSpacing(pattern.flamMs);
             engine.setAccentLevel(pattern.accent);
             lcd->setShuffleAccent(pattern.shuffle, pattern.accent);
             lcd->setBpmValue(pattern.bpm, true);
@@ -2066,39 +2356,21 @@ public:
                 return std::abs(a - b) > 0.0001f;
             };
 
-            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+            const auto& live = engine.getSequencer().getPattern();
+            if (slot.grid != live)
             {
-                for (int step = 0; step < 16; ++step)
-                {
-                    const auto newStep = engine.getSequencer().getStep((Instrument)inst, step);
-                    if (slot.steps[inst][step] != newStep)
-                    {
-                        slot.steps[inst][step] = newStep;
-                        changed = true;
-                    }
-
-                    for (int param = 0; param < (int)AutomationParam::Count; ++param)
-                    {
-                        float value = 0.0f;
-                        const bool active = engine.getSequencer().getAutomationPoint(
-                            (Instrument)inst, (AutomationParam)param, step, value);
-                        if (slot.automationActive[inst][param][step] != active
-                            || differsFloat(slot.automationValue[inst][param][step], value))
-                        {
-                            slot.automationActive[inst][param][step] = active;
-                            slot.automationValue[inst][param][step] = value;
-                            changed = true;
-                        }
-                    }
-                }
+                slot.grid = live;
+                changed = true;
             }
 
             const float bpmNow = engine.getSequencer().getBpm();
             const float shuffleNow = engine.getSequencer().getShuffle();
+            const float flamNow = engine.getSequencer().getFlamSpacing();
             const float accentNow = engine.getAccentLevel();
 
             if (differsFloat(slot.bpm, bpmNow)) { slot.bpm = bpmNow; changed = true; }
             if (differsFloat(slot.shuffle, shuffleNow)) { slot.shuffle = shuffleNow; changed = true; }
+            if (differsFloat(slot.flamMs, flamNow)) { slot.flamMs = flamNow; changed = true; }
             if (differsFloat(slot.accent, accentNow)) { slot.accent = accentNow; changed = true; }
             if (slot.name.isEmpty())
             {
@@ -2172,145 +2444,73 @@ public:
 
         bool loadPatternBanksFromDisk()
         {
-            const auto file = patternStorageFile();
-            if (!file.existsAsFile())
-                return false;
-
-            const auto json = juce::JSON::parse(file);
-            if (!json.isObject())
+            juce::Array<PatternData> stored;
+            if (!PatternIO::readBankFile(patternStorageFile(), stored))
                 return false;
 
-            auto* root = json.getDynamicObject();
-            auto banksVar = root->getProperty("banks");
-            if (!banksVar.isArray())
-                return false;
+            for (int i = 0; i < juce::jmin(stored.size(), numBanks * numPatternsPerBank); ++i)
+                patterns[(size_t)(i / numPatternsPerBank)][(size_t)(i % numPatternsPerBank)] = stored.getReference(i);
 
-            auto* banksArr = banksVar.getArray();
-            for (int b = 0; b < juce::jmin(numBanks, banksArr->size()); ++b)
-            {
-                auto bankVar = banksArr->getReference(b);
-                if (!bankVar.isArray())
-                    continue;
-                auto* pattArr = bankVar.getArray();
-                for (int p = 0; p < juce::jmin(numPatternsPerBank, pattArr->size()); ++p)
-                {
-                    auto pattVar = pattArr->getReference(p);
-                    if (!pattVar.isObject())
-                        continue;
-                    auto* obj = pattVar.getDynamicObject();
-                    auto& dst = patterns[(size_t)b][(size_t)p];
-                    dst.name = obj->getProperty("name").toString();
-                    dst.bpm = (float)obj->getProperty("bpm");
-                    dst.shuffle = (float)obj->getProperty("shuffle");
-                    dst.accent = (float)obj->getProperty("accent");
-
-                    auto stepsStr = obj->getProperty("steps").toString();
-                    int idx = 0;
-                    for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-                    {
-                        for (int step = 0; step < 16; ++step)
-                        {
-                            StepState state = StepState::Off;
-                            if (idx < stepsStr.length())
-                            {
-                                auto c = stepsStr[(int)idx++];
-                                if (c == '1') state = StepState::On;
-                                else if (c == '2') state = StepState::Accent;
-                            }
-                            dst.steps[inst][step] = state;
-                        }
-                    }
+            return true;
+        }
 
-                    for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-                        for (int param = 0; param < (int)AutomationParam::Count; ++param)
-                            for (int step = 0; step < 16; ++step)
-                            {
-                                dst.automationActive[inst][param][step] = false;
-                                dst.automationValue[inst][param][step] = 0.0f;
-                            }
+        void savePatternBanksToDisk()
+        {
+            PatternIO::writeBankFile(patternStorageFile(), collectPatterns(0, numBanks * numPatternsPerBank));
+        }
 
-                    auto autoVar = obj->getProperty("automation");
-                    if (autoVar.isArray())
-                    {
-                        auto* autoArr = autoVar.getArray();
-                        for (int i = 0; i < autoArr->size(); ++i)
-                        {
-                            auto pointVar = autoArr->getReference(i);
-                            if (!pointVar.isObject())
-                                continue;
-
-                            auto* point = pointVar.getDynamicObject();
-                            const int inst = (int)point->getProperty("i");
-                            const int param = (int)point->getProperty("p");
-                            const int step = (int)point->getProperty("s");
-                            const float value = (float)point->getProperty("v");
-
-                            if (inst < 0 || inst >= (int)Instrument::Count
-                                || param < 0 || param >= (int)AutomationParam::Count
-                                || step < 0 || step >= 16)
-                                continue;
-
-                            dst.automationActive[inst][param][step] = true;
-                            dst.automationValue[inst][param][step] = juce::jlimit(0.0f, 1.0f, value);
-                        }
-                    }
-                }
-            }
+        juce::Array<PatternData> collectPatterns(int first, int count) const
+        {
+            juce::Array<PatternData> result;
+            for (int i = first; i < first + count; ++i)
+                result.add(patterns[(size_t)(i / numPatternsPerBank)][(size_t)(i % numPatternsPerBank)]);
+            return result;
+        }
 
-            return true;
+        void exportMidi(const juce::Array<PatternData>& toExport, const juce::String& name)
+        {
+            const auto start = juce::File::getSpecialLocation(juce::File::userDocumentsDirectory)
+                .getChildFile(juce::File::createLegalFileName(name) + ".mid");
+            fileChooser = std::make_unique<juce::FileChooser>("Export MIDI", start, "*.mid");
+            fileChooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                         | juce::FileBrowserComponent::warnAboutOverwriting,
+                                     [toExport](const juce::FileChooser& chooser)
+                                     {
+                                         const auto file = chooser.getResult();
+                                         if (file != juce::File() && !PatternIO::writeMidiFile(file.withFileExtension("mid"), toExport))
+                                             juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Export MIDI",
+                                                                                    "Could not write " + file.getFullPathName());
+                                     });
         }
 
-        void savePatternBanksToDisk()
+        // Imported patterns fill the bank from the given slot onwards; any that do not fit are dropped.
+        void importMidi(int bank, int pattern)
         {
-            juce::DynamicObject::Ptr root(new juce::DynamicObject());
-            juce::Array<juce::var> banksVar;
+            fileChooser = std::make_unique<juce::FileChooser>("Import MIDI",
+                juce::File::getSpecialLocation(juce::File::userDocumentsDirectory), "*.mid;*.midi");
+            fileChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                     [this, bank, pattern](const juce::FileChooser& chooser)
+                                     {
+                                         const auto file = chooser.getResult();
+                                         if (file == juce::File())
+                                             return;
 
-            for (int b = 0; b < numBanks; ++b)
-            {
-                juce::Array<juce::var> pattVar;
-                for (int p = 0; p < numPatternsPerBank; ++p)
-                {
-                    const auto& src = patterns[(size_t)b][(size_t)p];
-                    juce::String steps;
-                    steps.preallocateBytes((int)Instrument::Count * 16);
-                    for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-                        for (int step = 0; step < 16; ++step)
-                            steps += juce::String((int)src.steps[inst][step]);
-
-                    juce::DynamicObject::Ptr patt(new juce::DynamicObject());
-                    patt->setProperty("name", src.name);
-                    patt->setProperty("bpm", src.bpm);
-                    patt->setProperty("shuffle", src.shuffle);
-                    patt->setProperty("accent", src.accent);
-                    patt->setProperty("steps", steps);
-
-                    juce::Array<juce::var> automation;
-                    for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-                    {
-                        for (int param = 0; param < (int)AutomationParam::Count; ++param)
-                        {
-                            for (int step = 0; step < 16; ++step)
-                            {
-                                if (!src.automationActive[inst][param][step])
-                                    continue;
-
-                                juce::DynamicObject::Ptr point(new juce::DynamicObject());
-                                point->setProperty("i", inst);
-                                point->setProperty("p", param);
-                                point->setProperty("s", step);
-                                point->setProperty("v", src.automationValue[inst][param][step]);
-                                automation.add(juce::var(point.get()));
-                            }
-                        }
-                    }
-                    patt->setProperty("automation", juce::var(automation));
-                    pattVar.add(juce::var(patt.get()));
-                }
-                banksVar.add(juce::var(pattVar));
-            }
+                                         juce::Array<PatternData> imported;
+                                         if (!PatternIO::readMidiFile(file, imported))
+                                         {
+                                             juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Import MIDI",
+                                                                                    "No drum patterns found in " + file.getFileName());
+                                             return;
+                                         }
+
+                                         const int count = juce::jmin(imported.size(), numPatternsPerBank - pattern);
+                                         for (int i = 0; i < count; ++i)
+                                             patterns[(size_t)bank][(size_t)(pattern + i)] = imported.getReference(i);
 
-            root->setProperty("banks", juce::var(banksVar));
-            patternStorageFile().replaceWithText(juce::JSON::toString(juce::var(root.get())));
+                                         hasUserPatternChanges = true;
+                                         selectPattern(bank, pattern, true);
+                                         updatePatternManagerNames();
+                                     });
         }
 
         void initialisePatternBanks()
@@ -2388,6 +2588,7 @@ public:
         void toggleRecording()
         {
             recordingEnabled = !recordingEnabled;
+            engine.setRecording(recordingEnabled);
             recBtn.setColour(juce::TextButton::buttonColourId,
                              recordingEnabled ? juce::Colour(0xffcc3030) : juce::Colour(0xffb0b0b0));
             recBtn.setColour(juce::TextButton::textColourOffId,
@@ -2411,6 +2612,12 @@ public:
             if (!recordingEnabled)
                 return;
 
+            if (engine.isRunning())
+            {
+                engine.recordAutomation(kd.instrument, toAutomationParam(kd.param), value);
+                return;
+            }
+
             const int step = getRecordStepIndex();
             engine.getSequencer().setAutomationPoint(kd.instrument, toAutomationParam(kd.param), step, value);
             hasUserPatternChanges = true;
@@ -2420,6 +2627,134 @@ public:
                 grid->repaint();
         }
 
+        void applyRecordedEvents()
+        {
+            RecordedEvent event;
+            if (!engine.popRecordedEvent(event))
+                return;
+
+            auto& seq = engine.getSequencer();
+            const int length = seq.getLength();
+            {
+                const Sequencer::ScopedEdit edit(seq);
+                do
+                {
+                    // Quantise pulls each event towards its nearest step; whatever is left of the
+                    // played timing becomes the hit's microtiming.
+                    const double nearest = std::round(event.phase);
+                    const int step = (int)(((juce::int64)nearest % length + length) % length);
+                    const float offset = (float)(event.phase - nearest) * (1.0f - recordQuantise);
+
+                    switch (event.type)
+                    {
+                        case RecordedEvent::Type::Hit:
+                        {
+                            const bool accent = event.accent || seq.getStep(event.track, step) == StepState::Accent;
+                            seq.setStep(event.track, step, accent ? StepState::Accent : StepState::On);
+                            seq.setMicrotiming(event.track, step, offset);
+                            break;
+                        }
+                        case RecordedEvent::Type::Automation:
+                            seq.setAutomationPoint(event.track, event.param, step, event.value);
+                            break;
+                        case RecordedEvent::Type::Tempo:
+                            seq.setTempoPoint(step, event.value);
+                            break;
+                    }
+                }
+                while (engine.popRecordedEvent(event));
+            }
+
+            hasUserPatternChanges = true;
+            updateCurrentPatternFromEngine();
+        }
+
+        bool editSelectedTrack(juce_wchar kc)
+        {
+            auto& seq = engine.getSequencer();
+            switch (kc)
+            {
+                case ',': seq.rotateTrack(selectedInstrument, -1); break;
+                case '.': seq.rotateTrack(selectedInstrument, 1); break;
+                case '<': seq.shiftTrack(selectedInstrument, -1); break;
+                case '>': seq.shiftTrack(selectedInstrument, 1); break;
+                case 'i':
+                case 'I': seq.invertTrack(selectedInstrument); break;
+                case 'm':
+                case 'M': seq.mirrorTrack(selectedInstrument); break;
+                case 'c':
+                case 'C':
+                    rowClipboard = seq.getPattern();
+                    rowClipboardInstrument = selectedInstrument;
+                    return true;
+                case 'v':
+                case 'V':
+                {
+                    if (!rowClipboard.has_value())
+                        return true;
+                    auto edited = seq.getPattern();
+                    edited.copyTrack(*rowClipboard, rowClipboardInstrument, selectedInstrument);
+                    seq.setPattern(edited);
+                    break;
+                }
+                default:
+                    return false;
+            }
+
+            hasUserPatternChanges = true;
+            updateCurrentPatternFromEngine();
+            stepButtonRow->refresh();
+            if (panelExpanded)
+                grid->repaint();
+            return true;
+        }
+
+        void toggleLayer(int bank, int pattern)
+        {
+            // A pattern already layered comes off again; otherwise it takes the first free layer.
+            auto& seq = engine.getSequencer();
+            const int id = bank * numPatternsPerBank + pattern;
+            for (int layer = 1; layer < Sequencer::maxLayers; ++layer)
+            {
+                if (layerSlots[(size_t)layer] == id)
+                {
+                    seq.clearLayer(layer);
+                    layerSlots[(size_t)layer] = -1;
+                    repaint();
+                    return;
+                }
+            }
+
+            for (int layer = 1; layer < Sequencer::maxLayers; ++layer)
+            {
+                if (layerSlots[(size_t)layer] < 0)
+                {
+                    seq.setLayerPattern(layer, patterns[(size_t)bank][(size_t)pattern].grid, 16);
+                    layerSlots[(size_t)layer] = id;
+                    repaint();
+                    return;
+                }
+            }
+        }
+
+        juce::String describeLayers()
+        {
+            juce::String text;
+            for (int layer = 1; layer < Sequencer::maxLayers; ++layer)
+            {
+                const int id = layerSlots[(size_t)layer];
+                if (id < 0)
+                    continue;
+
+                const int bank = id / numPatternsPerBank;
+                const int pattern = id % numPatternsPerBank;
+                text << "L" << layer << ":" << juce::String(pattern + 1).paddedLeft('0', 2)
+                     << juce::String::charToString((juce_wchar)('A' + bank))
+                     << (engine.getSequencer().isLayerMuted(layer) ? "(M) " : " ");
+            }
+            return text.isEmpty() ? text : "LAYERS " + text.trimEnd();
+        }
+
         void requestClearTrackAutomation(Instrument inst)
         {
             if (!engine.getSequencer().hasAutomation(inst))
@@ -2470,11 +2805,23 @@ public:
             juce::AlertWindow::showMessageBoxAsync(
                 juce::AlertWindow::InfoIcon,
                 "LoS.9x9 Controls",
-                "Space: Start/Stop\n"
+                "Space: Start/Stop   Shift+Space: Continue from where it stopped\n"
                 "A S D F G H J K L ; ' : Trigger drums\n"
-                "MANAGE: Pattern manager\n"
+                ", . : Rotate selected row   < > : Shift row\n"
+                "I: Invert row   M: Mirror row   C / V: Copy / paste row\n"
+                "[ ]: Flam spacing   1 2 3: Mute / unmute layers\n"
+                "N: Map the next MIDI note to the selected drum (pads follow the GM drum map)\n"
+                "Drop audio files on the window to add sample tracks (the next MIDI note plays the last one)\n"
+                "- =: Previous / next sample kit (drop a folder of samples on the window to make one)\n"
+                "Q: Record quantise strength (100 / 75 / 50 / 0%), REC + play records hits and knobs\n"
+                "E: Follow external MIDI clock (clock is always sent on the default MIDI output)\n"
+                "BPM display: drag to set tempo (REC + play records tempo automation),\n"
+                "Shift+right-click for a tempo ramp, Alt-click to clear tempo automation\n"
+                "MANAGE: Pattern manager (LAYER plays a pattern on top of the current one,\n"
+                "MIDI PATT / MIDI BANK export Standard MIDI Files, IMPORT MIDI fills the bank from the selected slot)\n"
                 "CLEAR: Clear current pattern\n"
-                "Expanded view row controls: NIL (clear knob motion), CLR (clear row steps)",
+                "Expanded view row controls: NIL (clear knob motion), CLR (clear row steps)\n"
+                "Expanded view steps: Alt-click toggles flam, Shift-drag nudges timing",
                 "OK",
                 this);
         }
@@ -2493,8 +2840,7 @@ public:
             if (!confirm)
                 return;
 
-            for (int step = 0; step < 16; ++step)
-                engine.getSequencer().setStep(inst, step, StepState::Off);
+            engine.getSequencer().clearTrack(inst);
 
             hasUserPatternChanges = true;
             saveCurrentPatternSlot();
@@ -2531,8 +2877,21 @@ public:
 
         void timerCallback() override
         {
+            applyRecordedEvents();
             updateCurrentPatternFromEngine();
-            int currentStep = engine.getSequencer().getCurrentStep();
+
+            // The pattern's prebuilt sounds were rendered before the reference pack arrived.
+            if (engine.installReferencePack())
+                engine.loadPatternSounds(patterns[(size_t)currentBank][(size_t)currentPattern].grid, 16);
+
+            // Light the step being heard right now rather than the one the audio thread rendered last.
+            const auto transport = engine.getSequencer().getTransportPosition();
+            int currentStep = transport.step;
+            if (transport.running)
+            {
+                const auto heard = (juce::int64)std::floor(transport.getHeardPhase(juce::Time::getMillisecondCounterHiRes()));
+                currentStep = heard < 0 ? 0 : (int)(heard % engine.getSequencer().getLength());
+            }
 
             stepButtonRow->setCurrentStep(currentStep);
             stepButtonRow->refresh();
@@ -2606,6 +2965,13 @@ public:
         const juce::String getApplicationVersion() override { return "0.3.0"; }
         void initialise(const juce::String& commandLine) override
         {
+            if (commandLine.contains("--convert"))
+            {
+                setApplicationReturnValue(runConversion(commandLine));
+                quit();
+                return;
+            }
+
             const bool captureReadmeShots = commandLine.containsIgnoreCase("--capture-readme-screenshots");
             mainWindow.reset(new MainWindow(getApplicationName(), captureReadmeShots));
         }
@@ -2613,6 +2979,52 @@ public:
 
     private:
         std::unique_ptr<MainWindow> mainWindow;
+
+        // LoS9x9 --convert <files or folders>... [--out <folder>] [--chain A01,A02,...] [--threads n]
+        static int runConversion(const juce::String& commandLine)
+        {
+            const auto args = juce::StringArray::fromTokens(commandLine, true);
+            juce::Array<juce::File> inputs;
+            juce::File outputDir;
+            juce::Array<int> chain;
+            int numThreads = juce::SystemStats::getNumCpus();
+
+            for (int i = 0; i < args.size(); ++i)
+            {
+                const auto arg = args[i].unquoted();
+                if (arg == "--convert")
+                    continue;
+
+                if (arg == "--out" && i + 1 < args.size())
+                    outputDir = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i].unquoted());
+                else if (arg == "--threads" && i + 1 < args.size())
+                    numThreads = args[++i].getIntValue();
+                else if (arg == "--chain" && i + 1 < args.size())
+                {
+                    if (!PatternIO::parseChain(args[++i].unquoted(), chain))
+                    {
+                        std::cerr << "Bad chain: " << args[i] << std::endl;
+                        return 1;
+                    }
+                }
+                else
+                    inputs.add(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+            }
+
+            if (inputs.isEmpty())
+            {
+                std::cerr << "Usage: LoS9x9 --convert <files or folders>... [--out <folder>] [--chain A01,A02,...] [--threads n]" << std::endl;
+                return 1;
+            }
+
+            if (outputDir != juce::File())
+                outputDir.createDirectory();
+
+            const auto failures = PatternIO::convertFiles(inputs, outputDir, chain, numThreads);
+            for (const auto& failure : failures)
+                std::cerr << failure << std::endl;
+            return failures.isEmpty() ? 0 : 1;
+        }
     };
 }
 
@@ -0,0 +1,183 @@
+#include "MidiClock.h"
+
+namespace rb338
+{
+    void MidiClockFollower::prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        reset();
+    }
+
+    void MidiClockFollower::reset()
+    {
+        pulsesSeen = 0;
+        nextPulse = 0;
+        lastArrival = 0.0;
+        expectedTime = 0.0;
+        period = 0.0;
+    }
+
+    void MidiClockFollower::setBandwidth(double hz)
+    {
+        bandwidthHz = juce::jlimit(0.05, 10.0, hz);
+    }
+
+    void MidiClockFollower::start(juce::int64 firstPulse)
+    {
+        nextPulse = firstPulse;
+    }
+
+    void MidiClockFollower::pulse(double time)
+    {
+        ++nextPulse;
+
+        if (pulsesSeen > 0 && time <= lastArrival)
+            return;
+
+        if (pulsesSeen == 0)
+        {
+            lastArrival = time;
+            pulsesSeen = 1;
+            return;
+        }
+
+        if (pulsesSeen == 1)
+        {
+            period = time - lastArrival;
+            expectedTime = time + period;
+            lastArrival = time;
+            pulsesSeen = 2;
+            return;
+        }
+
+        // Anything further out than a couple of pulses is a dropout or a tempo jump rather
+        // than jitter, so start over from this pulse.
+        const double error = time - expectedTime;
+        if (std::abs(error) > period * 2.0)
+        {
+            lastArrival = time;
+            pulsesSeen = 1;
+            return;
+        }
+
+        // Open the loop wide while the first beat comes in so the period settles quickly,
+        // then narrow it down to the configured bandwidth.
+        const double settling = juce::jmax(1.0, (double)pulsesPerQuarter / (double)pulsesSeen * 4.0);
+        const double omega = juce::jmin(0.6, juce::MathConstants<double>::twoPi * bandwidthHz * settling * period / sampleRate);
+
+        expectedTime += period + juce::MathConstants<double>::sqrt2 * omega * error;
+        period += omega * omega * error;
+        lastArrival = time;
+        ++pulsesSeen;
+    }
+
+    void MidiClockFollower::advanceTo(double time)
+    {
+        if (pulsesSeen == 0)
+            return;
+
+        // A quarter second without clock, or several missed pulses at slow tempos.
+        const double timeout = juce::jmax(0.25 * sampleRate, period * 8.0);
+        if (time - lastArrival > timeout)
+        {
+            pulsesSeen = 0;
+            period = 0.0;
+        }
+    }
+
+    bool MidiClockFollower::isLocked() const
+    {
+        return pulsesSeen >= pulsesPerQuarter && period > 0.0;
+    }
+
+    double MidiClockFollower::getBpm() const
+    {
+        if (period <= 0.0)
+            return 0.0;
+        return 60.0 * sampleRate / (period * (double)pulsesPerQuarter);
+    }
+
+    double MidiClockFollower::getPulseLength() const
+    {
+        return period;
+    }
+
+    juce::int64 MidiClockFollower::getNextPulse() const
+    {
+        return nextPulse;
+    }
+
+    double MidiClockFollower::getPulseTime(double pulseIndex) const
+    {
+        return expectedTime + (pulseIndex - (double)nextPulse) * period;
+    }
+
+    MidiClockSender::MidiClockSender()
+        : juce::Thread("MIDI clock sender")
+    {
+        block.ensureSize(queueSize * 4);
+        startThread();
+    }
+
+    MidiClockSender::~MidiClockSender()
+    {
+        stopThread(1000);
+    }
+
+    void MidiClockSender::setOutput(std::unique_ptr<juce::MidiOutput> newOutput)
+    {
+        if (newOutput != nullptr)
+            newOutput->startBackgroundThread();
+
+        {
+            const juce::ScopedLock sl(outputLock);
+            std::swap(output, newOutput);
+        }
+
+        // The previous device, if any, closes here, outside the lock.
+    }
+
+    bool MidiClockSender::push(const juce::MidiMessage& message, double timeMs)
+    {
+        const auto scope = queue.write(1);
+        if (scope.blockSize1 + scope.blockSize2 == 0)
+            return false;
+
+        auto& slot = queued[(size_t)(scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)];
+        slot.status = message.getRawData()[0];
+        slot.timeMs = timeMs;
+        return true;
+    }
+
+    void MidiClockSender::run()
+    {
+        while (!threadShouldExit())
+        {
+            sendQueued();
+            wait(drainIntervalMs);
+        }
+    }
+
+    void MidiClockSender::sendQueued()
+    {
+        const auto scope = queue.read(queue.getNumReady());
+        const int count = scope.blockSize1 + scope.blockSize2;
+        if (count == 0)
+            return;
+
+        // Positions in the block are in ticks of a tenth of a millisecond from the first message,
+        // and the output's own thread sends each one when its time comes.
+        constexpr double ticksPerSecond = 10000.0;
+        const double startMs = queued[(size_t)(scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)].timeMs;
+        block.clear();
+        for (int i = 0; i < count; ++i)
+        {
+            const auto& message = queued[(size_t)(i < scope.blockSize1 ? scope.startIndex1 + i : scope.startIndex2 + i - scope.blockSize1)];
+            block.addEvent(juce::MidiMessage((int)message.status), juce::roundToInt((message.timeMs - startMs) * 0.001 * ticksPerSecond));
+        }
+
+        const juce::ScopedLock sl(outputLock);
+        if (output != nullptr)
+            output->sendBlockOfMessages(block, startMs, ticksPerSecond);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+
+namespace rb338
+{
+    // Recovers a steady tempo and phase from incoming MIDI clock (24 pulses per quarter note).
+    // Pulse arrival times are run through a second-order delay-locked loop, which smooths out
+    // the jitter that drivers and audio buffering add while still following tempo changes.
+    // Times are in samples on any monotonic timeline; nothing here touches a device.
+    class MidiClockFollower
+    {
+    public:
+        static constexpr int pulsesPerQuarter = 24;
+
+        void prepare(double sampleRate);
+        void reset();
+        void setBandwidth(double hz); // loop bandwidth once settled, lower = smoother but slower
+
+        void start(juce::int64 firstPulse = 0); // Start or Continue received: numbers the next pulse
+        void pulse(double time);
+        void advanceTo(double time); // drops the lock when pulses stop arriving
+
+        bool isLocked() const;
+        double getBpm() const;
+        double getPulseLength() const; // filtered, in samples
+        juce::int64 getNextPulse() const; // index of the next expected pulse, counted from start
+        double getPulseTime(double pulseIndex) const; // filtered position of a pulse, past or future
+
+    private:
+        double sampleRate = 44100.0;
+        double bandwidthHz = 0.5;
+
+        int pulsesSeen = 0;
+        juce::int64 nextPulse = 0;
+        double lastArrival = 0.0;
+        double expectedTime = 0.0; // filtered time of nextPulse
+        double period = 0.0;
+    };
+
+    // Sends clock on a MIDI output. The audio thread queues each message with the time it is to
+    // go out at, without locking or allocating, and a background thread hands what has queued up
+    // to the device every drainIntervalMs. Without an output the queue is drained and dropped.
+    class MidiClockSender : private juce::Thread
+    {
+    public:
+        static constexpr int drainIntervalMs = 1; // the latest a queued message is picked up
+        static constexpr int queueSize = 1024; // several seconds of clock at any tempo
+
+        MidiClockSender();
+        ~MidiClockSender() override;
+
+        void setOutput(std::unique_ptr<juce::MidiOutput> newOutput); // the previous output closes here
+
+        // Audio thread. A one-byte realtime message (clock, Start, Continue, Stop) to send at a
+        // Time::getMillisecondCounterHiRes time. False, dropping it, if the queue is full.
+        bool push(const juce::MidiMessage& message, double timeMs);
+
+    private:
+        struct QueuedMessage
+        {
+            juce::uint8 status = 0;
+            double timeMs = 0.0;
+        };
+
+        juce::AbstractFifo queue { queueSize };
+        std::array<QueuedMessage, queueSize> queued;
+        juce::CriticalSection outputLock; // between setOutput and the sending thread, never the audio thread
+        std::unique_ptr<juce::MidiOutput> output;
+        juce::MidiBuffer block;
+
+        void run() override;
+        void sendQueued();
+    };
+}
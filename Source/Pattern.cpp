@@ -0,0 +1,472 @@
+#include "Pattern.h"
+
+namespace rb338
+{
+    namespace StepBits
+    {
+        int count(StepMask lane)
+        {
+            return juce::countNumberOfBits((juce::uint64)lane);
+        }
+
+        int lowest(StepMask lane)
+        {
+            return count((lane & (~lane + 1)) - 1);
+        }
+
+        StepMask rotate(StepMask lane, int length, int amount)
+        {
+            length = juce::jlimit(0, maxPatternSteps, length);
+            if (length <= 1)
+                return lane;
+
+            const StepMask inside = lengthMask(length);
+            const StepMask bits = lane & inside;
+            const int a = ((amount % length) + length) % length;
+            if (a == 0)
+                return lane;
+
+            const StepMask rotated = ((bits << a) | (bits >> (length - a))) & inside;
+            return (lane & ~inside) | rotated;
+        }
+
+        StepMask shift(StepMask lane, int length, int amount)
+        {
+            length = juce::jlimit(0, maxPatternSteps, length);
+            const StepMask inside = lengthMask(length);
+            const StepMask bits = lane & inside;
+
+            StepMask shifted = 0;
+            if (amount >= length || -amount >= length)
+                shifted = 0;
+            else if (amount >= 0)
+                shifted = (bits << amount) & inside;
+            else
+                shifted = bits >> -amount;
+
+            return (lane & ~inside) | shifted;
+        }
+
+        StepMask reverse(StepMask lane, int length)
+        {
+            length = juce::jlimit(0, maxPatternSteps, length);
+            if (length <= 1)
+                return lane;
+
+            const StepMask inside = lengthMask(length);
+            StepMask r = lane;
+            r = ((r >> 1) & 0x5555555555555555ull) | ((r & 0x5555555555555555ull) << 1);
+            r = ((r >> 2) & 0x3333333333333333ull) | ((r & 0x3333333333333333ull) << 2);
+            r = ((r >> 4) & 0x0f0f0f0f0f0f0f0full) | ((r & 0x0f0f0f0f0f0f0f0full) << 4);
+            r = ((r >> 8) & 0x00ff00ff00ff00ffull) | ((r & 0x00ff00ff00ff00ffull) << 8);
+            r = ((r >> 16) & 0x0000ffff0000ffffull) | ((r & 0x0000ffff0000ffffull) << 16);
+            r = (r >> 32) | (r << 32);
+
+            return (lane & ~inside) | ((r >> (maxPatternSteps - length)) & inside);
+        }
+    }
+
+    bool PatternGrid::isValid(int track, int step)
+    {
+        return track >= 0 && track < numTracks && step >= 0 && step < maxPatternSteps;
+    }
+
+    StepState PatternGrid::getStep(TrackId trackId, int step) const
+    {
+        if (!isValid(trackId.index, step))
+            return StepState::Off;
+
+        const auto& lane = lanes[trackId.index];
+        if ((lane.accent & StepBits::bit(step)) != 0)
+            return StepState::Accent;
+        if ((lane.on & StepBits::bit(step)) != 0)
+            return StepState::On;
+        return StepState::Off;
+    }
+
+    void PatternGrid::setStep(TrackId trackId, int step, StepState state)
+    {
+        if (!isValid(trackId.index, step))
+            return;
+
+        auto& lane = lanes[trackId.index];
+        const auto b = StepBits::bit(step);
+        lane.on = (state != StepState::Off) ? (lane.on | b) : (lane.on & ~b);
+        lane.accent = (state == StepState::Accent) ? (lane.accent | b) : (lane.accent & ~b);
+
+        if (state == StepState::Off)
+        {
+            lane.flam &= ~b;
+            microtiming[trackId.index][step] = 0.0f;
+        }
+    }
+
+    void PatternGrid::cycleStep(TrackId trackId, int step)
+    {
+        const auto state = getStep(trackId, step);
+        if (state == StepState::Off)
+            setStep(trackId, step, StepState::On);
+        else if (state == StepState::On)
+            setStep(trackId, step, StepState::Accent);
+        else
+            setStep(trackId, step, StepState::Off);
+    }
+
+    void PatternGrid::clear()
+    {
+        for (int track = 0; track < numTracks; ++track)
+            clearTrack(TrackId(track));
+    }
+
+    void PatternGrid::clearTrack(TrackId trackId)
+    {
+        if (!isValid(trackId.index, 0))
+            return;
+
+        lanes[trackId.index] = {};
+        for (auto& offset : microtiming[trackId.index])
+            offset = 0.0f;
+    }
+
+    const TrackLanes& PatternGrid::getLanes(TrackId trackId) const
+    {
+        static const TrackLanes empty;
+        return isValid(trackId.index, 0) ? lanes[trackId.index] : empty;
+    }
+
+    bool PatternGrid::isEmpty() const
+    {
+        StepMask any = 0;
+        for (const auto& lane : lanes)
+            any |= lane.on;
+        return any == 0;
+    }
+
+    bool PatternGrid::getFlam(TrackId trackId, int step) const
+    {
+        if (!isValid(trackId.index, step))
+            return false;
+        return (lanes[trackId.index].flam & StepBits::bit(step)) != 0;
+    }
+
+    void PatternGrid::setFlam(TrackId trackId, int step, bool shouldFlam)
+    {
+        if (!isValid(trackId.index, step))
+            return;
+
+        auto& lane = lanes[trackId.index];
+        const auto b = StepBits::bit(step);
+        lane.flam = (shouldFlam && (lane.on & b) != 0) ? (lane.flam | b) : (lane.flam & ~b);
+    }
+
+    float PatternGrid::getMicrotiming(TrackId trackId, int step) const
+    {
+        if (!isValid(trackId.index, step))
+            return 0.0f;
+        return microtiming[trackId.index][step];
+    }
+
+    void PatternGrid::setMicrotiming(TrackId trackId, int step, float offset)
+    {
+        if (!isValid(trackId.index, step) || (lanes[trackId.index].on & StepBits::bit(step)) == 0)
+            return;
+        microtiming[trackId.index][step] = juce::jlimit(-0.5f, 0.5f, offset);
+    }
+
+    void PatternGrid::setAutomationPoint(TrackId trackId, AutomationParam param, int step, float value)
+    {
+        const int track = trackId.index;
+        const int p = (int)param;
+        if (!isValid(track, step) || p < 0 || p >= numParams)
+            return;
+
+        automationMask[track][p] |= StepBits::bit(step);
+        automationValue[track][p][step] = juce::jlimit(0.0f, 1.0f, value);
+    }
+
+    bool PatternGrid::getAutomationPoint(TrackId trackId, AutomationParam param, int step, float& valueOut) const
+    {
+        const int track = trackId.index;
+        const int p = (int)param;
+        if (!isValid(track, step) || p < 0 || p >= numParams)
+            return false;
+
+        if ((automationMask[track][p] & StepBits::bit(step)) == 0)
+            return false;
+
+        valueOut = automationValue[track][p][step];
+        return true;
+    }
+
+    StepMask PatternGrid::getAutomationMask(TrackId trackId, AutomationParam param) const
+    {
+        const int track = trackId.index;
+        const int p = (int)param;
+        if (!isValid(track, 0) || p < 0 || p >= numParams)
+            return 0;
+        return automationMask[track][p];
+    }
+
+    StepMask PatternGrid::getAutomationMask(TrackId trackId) const
+    {
+        const int track = trackId.index;
+        if (!isValid(track, 0))
+            return 0;
+
+        StepMask any = 0;
+        for (int p = 0; p < numParams; ++p)
+            any |= automationMask[track][p];
+        return any;
+    }
+
+    bool PatternGrid::hasAutomation(TrackId trackId) const
+    {
+        return getAutomationMask(trackId) != 0;
+    }
+
+    void PatternGrid::clearAutomation(TrackId trackId)
+    {
+        const int track = trackId.index;
+        if (!isValid(track, 0))
+            return;
+
+        for (int p = 0; p < numParams; ++p)
+        {
+            automationMask[track][p] = 0;
+            for (auto& v : automationValue[track][p])
+                v = 0.0f;
+        }
+    }
+
+    void PatternGrid::clearAllAutomation()
+    {
+        for (int track = 0; track < numTracks; ++track)
+            clearAutomation(TrackId(track));
+    }
+
+    void PatternGrid::setTempoPoint(int step, float bpm)
+    {
+        if (!isValid(0, step))
+            return;
+
+        tempoMask |= StepBits::bit(step);
+        tempoValue[step] = juce::jlimit(40.0f, 200.0f, bpm);
+    }
+
+    bool PatternGrid::getTempoPoint(int step, float& bpmOut) const
+    {
+        if (!isValid(0, step) || (tempoMask & StepBits::bit(step)) == 0)
+            return false;
+
+        bpmOut = tempoValue[step];
+        return true;
+    }
+
+    void PatternGrid::clearTempoPoint(int step)
+    {
+        if (isValid(0, step))
+            tempoMask &= ~StepBits::bit(step);
+    }
+
+    StepMask PatternGrid::getTempoMask() const
+    {
+        return tempoMask;
+    }
+
+    void PatternGrid::clearTempoAutomation()
+    {
+        tempoMask = 0;
+        for (auto& v : tempoValue)
+            v = 0.0f;
+    }
+
+    void PatternGrid::remapStepValues(int track, int length, const int (&sourceStep)[maxPatternSteps])
+    {
+        float offsets[maxPatternSteps];
+        for (int step = 0; step < length; ++step)
+            offsets[step] = sourceStep[step] >= 0 ? microtiming[track][sourceStep[step]] : 0.0f;
+        for (int step = 0; step < length; ++step)
+            microtiming[track][step] = offsets[step];
+
+        for (int p = 0; p < numParams; ++p)
+        {
+            const StepMask before = automationMask[track][p];
+            if ((before & StepBits::lengthMask(length)) == 0)
+                continue;
+
+            float values[maxPatternSteps];
+            StepMask after = before & ~StepBits::lengthMask(length);
+            for (int step = 0; step < length; ++step)
+            {
+                const int src = sourceStep[step];
+                values[step] = 0.0f;
+                if (src >= 0 && (before & StepBits::bit(src)) != 0)
+                {
+                    values[step] = automationValue[track][p][src];
+                    after |= StepBits::bit(step);
+                }
+            }
+
+            for (int step = 0; step < length; ++step)
+                automationValue[track][p][step] = values[step];
+            automationMask[track][p] = after;
+        }
+    }
+
+    void PatternGrid::rotateTrack(TrackId trackId, int length, int amount)
+    {
+        const int track = trackId.index;
+        length = juce::jlimit(0, maxPatternSteps, length);
+        if (!isValid(track, 0) || length <= 1)
+            return;
+
+        auto& lane = lanes[track];
+        lane.on = StepBits::rotate(lane.on, length, amount);
+        lane.accent = StepBits::rotate(lane.accent, length, amount);
+        lane.flam = StepBits::rotate(lane.flam, length, amount);
+
+        int sourceStep[maxPatternSteps];
+        for (int step = 0; step < length; ++step)
+            sourceStep[step] = (((step - amount) % length) + length) % length;
+        remapStepValues(track, length, sourceStep);
+    }
+
+    void PatternGrid::shiftTrack(TrackId trackId, int length, int amount)
+    {
+        const int track = trackId.index;
+        length = juce::jlimit(0, maxPatternSteps, length);
+        if (!isValid(track, 0) || length <= 0 || amount == 0)
+            return;
+
+        auto& lane = lanes[track];
+        lane.on = StepBits::shift(lane.on, length, amount);
+        lane.accent = StepBits::shift(lane.accent, length, amount);
+        lane.flam = StepBits::shift(lane.flam, length, amount);
+
+        int sourceStep[maxPatternSteps];
+        for (int step = 0; step < length; ++step)
+        {
+            const int src = step - amount;
+            sourceStep[step] = (src >= 0 && src < length) ? src : -1;
+        }
+        remapStepValues(track, length, sourceStep);
+    }
+
+    void PatternGrid::invertTrack(TrackId trackId, int length)
+    {
+        const int track = trackId.index;
+        if (!isValid(track, 0))
+            return;
+
+        // Steps that were off become plain hits; accents and flams only survive where the step stays on.
+        auto& lane = lanes[track];
+        lane.on ^= StepBits::lengthMask(length);
+        lane.accent &= lane.on;
+        lane.flam &= lane.on;
+
+        for (int step = 0; step < juce::jlimit(0, maxPatternSteps, length); ++step)
+            if ((lane.on & StepBits::bit(step)) == 0)
+                microtiming[track][step] = 0.0f;
+    }
+
+    void PatternGrid::mirrorTrack(TrackId trackId, int length)
+    {
+        const int track = trackId.index;
+        length = juce::jlimit(0, maxPatternSteps, length);
+        if (!isValid(track, 0) || length <= 1)
+            return;
+
+        auto& lane = lanes[track];
+        lane.on = StepBits::reverse(lane.on, length);
+        lane.accent = StepBits::reverse(lane.accent, length);
+        lane.flam = StepBits::reverse(lane.flam, length);
+
+        int sourceStep[maxPatternSteps];
+        for (int step = 0; step < length; ++step)
+            sourceStep[step] = length - 1 - step;
+        remapStepValues(track, length, sourceStep);
+    }
+
+    void PatternGrid::copyTrack(const PatternGrid& source, TrackId from, TrackId to)
+    {
+        const int src = from.index;
+        const int dst = to.index;
+        if (!isValid(src, 0) || !isValid(dst, 0))
+            return;
+
+        lanes[dst] = source.lanes[src];
+        for (int step = 0; step < maxPatternSteps; ++step)
+            microtiming[dst][step] = source.microtiming[src][step];
+        for (int p = 0; p < numParams; ++p)
+        {
+            automationMask[dst][p] = source.automationMask[src][p];
+            for (int step = 0; step < maxPatternSteps; ++step)
+                automationValue[dst][p][step] = source.automationValue[src][p][step];
+        }
+    }
+
+    StepMask PatternGrid::diffSteps(const PatternGrid& other, TrackId trackId) const
+    {
+        const int track = trackId.index;
+        if (!isValid(track, 0))
+            return 0;
+
+        const auto& a = lanes[track];
+        const auto& b = other.lanes[track];
+        return (a.on ^ b.on) | (a.accent ^ b.accent) | (a.flam ^ b.flam);
+    }
+
+    bool PatternGrid::trackEquals(const PatternGrid& other, TrackId trackId) const
+    {
+        const int track = trackId.index;
+        if (!isValid(track, 0))
+            return true;
+
+        if (lanes[track] != other.lanes[track])
+            return false;
+
+        for (StepMask active = lanes[track].on; active != 0; active &= active - 1)
+        {
+            const int step = StepBits::lowest(active);
+            if (std::abs(microtiming[track][step] - other.microtiming[track][step]) > 0.0001f)
+                return false;
+        }
+
+        for (int p = 0; p < numParams; ++p)
+        {
+            StepMask active = automationMask[track][p];
+            if (active != other.automationMask[track][p])
+                return false;
+
+            // Only values behind a set bit are meaningful.
+            while (active != 0)
+            {
+                const int step = StepBits::lowest(active);
+                if (std::abs(automationValue[track][p][step] - other.automationValue[track][p][step]) > 0.0001f)
+                    return false;
+                active &= active - 1;
+            }
+        }
+
+        return true;
+    }
+
+    bool PatternGrid::operator==(const PatternGrid& other) const
+    {
+        for (int track = 0; track < numTracks; ++track)
+            if (!trackEquals(other, TrackId(track)))
+                return false;
+
+        if (tempoMask != other.tempoMask)
+            return false;
+
+        for (StepMask active = tempoMask; active != 0; active &= active - 1)
+        {
+            const int step = StepBits::lowest(active);
+            if (std::abs(tempoValue[step] - other.tempoValue[step]) > 0.0001f)
+                return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cstdint>
+#include "Tracks.h"
+
+namespace rb338
+{
+    enum class AutomationParam
+    {
+        Level = 0,
+        Tune,
+        Decay,
+        Tone,
+        Snappy,
+        Count
+    };
+
+    enum class StepState
+    {
+        Off = 0,
+        On = 1,
+        Accent = 2
+    };
+
+    // One bit per step. A lane holds up to maxPatternSteps steps, so whole-row edits and
+    // comparisons are a handful of integer ops instead of a loop over cells.
+    using StepMask = std::uint64_t;
+    static constexpr int maxPatternSteps = 64;
+
+    namespace StepBits
+    {
+        constexpr StepMask bit(int step) { return StepMask(1) << step; }
+        constexpr StepMask lengthMask(int length)
+        {
+            return length >= maxPatternSteps ? ~StepMask(0) : (length <= 0 ? StepMask(0) : bit(length) - 1);
+        }
+
+        int count(StepMask lane);
+        int lowest(StepMask lane); // index of lowest set bit, lane must be non-zero
+        StepMask rotate(StepMask lane, int length, int amount);
+        StepMask shift(StepMask lane, int length, int amount);
+        StepMask reverse(StepMask lane, int length);
+    }
+
+    // Trig state for one track. accent and flam are always subsets of on.
+    struct TrackLanes
+    {
+        StepMask on = 0;
+        StepMask accent = 0;
+        StepMask flam = 0;
+
+        bool operator==(const TrackLanes& other) const { return on == other.on && accent == other.accent && flam == other.flam; }
+        bool operator!=(const TrackLanes& other) const { return !(*this == other); }
+    };
+
+    class PatternGrid
+    {
+    public:
+        StepState getStep(TrackId track, int step) const;
+        void setStep(TrackId track, int step, StepState state);
+        void cycleStep(TrackId track, int step);
+        void clear();
+        void clearTrack(TrackId track);
+
+        const TrackLanes& getLanes(TrackId track) const;
+        bool isEmpty() const;
+
+        // Flam adds a grace hit ahead of the trig. Microtiming nudges a trig off the grid by a
+        // fraction of a step (-0.5 to 0.5). Both only apply to steps that are on.
+        bool getFlam(TrackId track, int step) const;
+        void setFlam(TrackId track, int step, bool shouldFlam);
+        float getMicrotiming(TrackId track, int step) const;
+        void setMicrotiming(TrackId track, int step, float offset);
+
+        void setAutomationPoint(TrackId track, AutomationParam param, int step, float value);
+        bool getAutomationPoint(TrackId track, AutomationParam param, int step, float& valueOut) const;
+        StepMask getAutomationMask(TrackId track, AutomationParam param) const;
+        StepMask getAutomationMask(TrackId track) const; // any parameter
+        bool hasAutomation(TrackId track) const;
+        void clearAutomation(TrackId track);
+        void clearAllAutomation();
+
+        // Tempo automation: a BPM value pinned to a step. Playback ramps linearly from each point
+        // to the next one, wrapping around the pattern.
+        void setTempoPoint(int step, float bpm);
+        bool getTempoPoint(int step, float& bpmOut) const;
+        void clearTempoPoint(int step);
+        StepMask getTempoMask() const;
+        void clearTempoAutomation();
+
+        // Row edits over the first `length` steps. Steps beyond length are left alone, and
+        // automation and microtiming move together with the trigs so they stay on their hit.
+        void rotateTrack(TrackId track, int length, int amount);
+        void shiftTrack(TrackId track, int length, int amount);
+        void invertTrack(TrackId track, int length);
+        void mirrorTrack(TrackId track, int length);
+        void copyTrack(const PatternGrid& source, TrackId from, TrackId to);
+
+        StepMask diffSteps(const PatternGrid& other, TrackId track) const; // steps whose trig differs
+        bool trackEquals(const PatternGrid& other, TrackId track) const;
+        bool operator==(const PatternGrid& other) const;
+        bool operator!=(const PatternGrid& other) const { return !(*this == other); }
+
+    private:
+        static constexpr int numTracks = maxTracks;
+        static constexpr int numParams = (int)AutomationParam::Count;
+
+        TrackLanes lanes[numTracks] = {};
+        StepMask automationMask[numTracks][numParams] = {};
+        float automationValue[numTracks][numParams][maxPatternSteps] = {};
+        float microtiming[numTracks][maxPatternSteps] = {};
+        StepMask tempoMask = 0;
+        float tempoValue[maxPatternSteps] = {};
+
+        static bool isValid(int track, int step);
+        void remapStepValues(int track, int length, const int (&sourceStep)[maxPatternSteps]);
+    };
+}
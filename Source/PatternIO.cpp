@@ -0,0 +1,741 @@
+#include "PatternIO.h"
+
+namespace rb338
+{
+    namespace
+    {
+        constexpr int ticksPerStep = PatternIO::ticksPerQuarter / 4;
+        constexpr int ticksPerPattern = ticksPerStep * PatternIO::patternSteps;
+        constexpr int drumChannel = 10;
+        constexpr int firstAutomationCC = 20;
+        constexpr int normalVelocity = 100;
+        constexpr int accentVelocity = 127;
+        constexpr float graceVelocityScale = 0.6f; // the sequencer plays flam grace hits at this scale
+        const char* const settingsTag = "LoS.9x9";
+
+        // One channel per drum for its automation, skipping the drum channel.
+        int automationChannel(int track)
+        {
+            return track + 1 < drumChannel ? track + 1 : track + 2;
+        }
+
+        int trackForAutomationChannel(int channel)
+        {
+            if (channel == drumChannel)
+                return -1;
+            return channel < drumChannel ? channel - 1 : channel - 2;
+        }
+
+        int tempoToMicroseconds(float bpm)
+        {
+            return juce::roundToInt(60000000.0 / juce::jlimit(40.0f, 200.0f, bpm));
+        }
+
+        // Settings the MIDI file has no event for, as "LoS.9x9 shuffle=0.25 accent=0.5 flam=20".
+        juce::String settingsText(const PatternData& pattern)
+        {
+            return juce::String(settingsTag)
+                + " shuffle=" + juce::String(pattern.shuffle, 3)
+                + " accent=" + juce::String(pattern.accent, 3)
+                + " flam=" + juce::String(pattern.flamMs, 1);
+        }
+
+        void parseSettingsText(const juce::String& text, PatternData& pattern)
+        {
+            auto tokens = juce::StringArray::fromTokens(text, " ", "");
+            if (tokens.isEmpty() || tokens[0] != settingsTag)
+                return;
+
+            for (const auto& token : tokens)
+            {
+                const auto key = token.upToFirstOccurrenceOf("=", false, false);
+                const auto value = token.fromFirstOccurrenceOf("=", false, false).getFloatValue();
+                if (key == "shuffle")
+                    pattern.shuffle = juce::jlimit(0.0f, 1.0f, value);
+                else if (key == "accent")
+                    pattern.accent = juce::jlimit(0.0f, 1.0f, value);
+                else if (key == "flam")
+                    pattern.flamMs = juce::jlimit(5.0f, 40.0f, value);
+            }
+        }
+
+        struct ImportedHit
+        {
+            double step = 0.0; // position in steps from the start of the file
+            int velocity = 0;
+        };
+
+        // A bank file is an object whose "banks" holds one array of patterns per bank.
+        bool isBankJson(const juce::var& json)
+        {
+            if (!json.isObject())
+                return false;
+
+            const auto banksVar = json.getDynamicObject()->getProperty("banks");
+            if (!banksVar.isArray())
+                return false;
+
+            for (const auto& bankVar : *banksVar.getArray())
+                if (!bankVar.isArray())
+                    return false;
+
+            return true;
+        }
+
+        bool isBankFile(const juce::File& file)
+        {
+            return file.existsAsFile() && isBankJson(juce::JSON::parse(file));
+        }
+
+        // What one input of a batch conversion writes. A bank file without a chain writes one MIDI
+        // file per bank, named after it with the bank letter, so `output` is then only the stem.
+        struct ConvertJob
+        {
+            juce::File input;
+            juce::File output;
+            bool perBank = false;
+
+            bool writes(const juce::File& file) const
+            {
+                if (!perBank)
+                    return file == output;
+
+                const auto name = file.getFileNameWithoutExtension();
+                return file.getParentDirectory() == output.getParentDirectory() && file.hasFileExtension("mid")
+                    && name.length() == output.getFileName().length() + 2
+                    && name.startsWith(output.getFileName() + "-");
+            }
+
+            bool writesSameAs(const ConvertJob& other) const
+            {
+                return perBank == other.perBank && output == other.output;
+            }
+        };
+    }
+
+    namespace PatternIO
+    {
+        juce::var toVar(const PatternData& pattern)
+        {
+            juce::String steps;
+            steps.preallocateBytes((int)Instrument::Count * patternSteps);
+            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+                for (int step = 0; step < patternSteps; ++step)
+                    steps += juce::String((int)pattern.grid.getStep((Instrument)inst, step));
+
+            juce::DynamicObject::Ptr patt(new juce::DynamicObject());
+            patt->setProperty("name", pattern.name);
+            patt->setProperty("bpm", pattern.bpm);
+            patt->setProperty("shuffle", pattern.shuffle);
+            patt->setProperty("accent", pattern.accent);
+            patt->setProperty("flamMs", pattern.flamMs);
+            patt->setProperty("steps", steps);
+
+            juce::Array<juce::var> automation;
+            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+            {
+                for (int param = 0; param < (int)AutomationParam::Count; ++param)
+                {
+                    auto active = pattern.grid.getAutomationMask((Instrument)inst, (AutomationParam)param);
+                    while (active != 0)
+                    {
+                        const int step = StepBits::lowest(active);
+                        active &= active - 1;
+
+                        float value = 0.0f;
+                        pattern.grid.getAutomationPoint((Instrument)inst, (AutomationParam)param, step, value);
+
+                        juce::DynamicObject::Ptr point(new juce::DynamicObject());
+                        point->setProperty("i", inst);
+                        point->setProperty("p", param);
+                        point->setProperty("s", step);
+                        point->setProperty("v", value);
+                        automation.add(juce::var(point.get()));
+                    }
+                }
+            }
+            patt->setProperty("automation", juce::var(automation));
+
+            juce::Array<juce::var> timing;
+            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+            {
+                for (int step = 0; step < patternSteps; ++step)
+                {
+                    const bool flam = pattern.grid.getFlam((Instrument)inst, step);
+                    const float offset = pattern.grid.getMicrotiming((Instrument)inst, step);
+                    if (!flam && offset == 0.0f)
+                        continue;
+
+                    juce::DynamicObject::Ptr point(new juce::DynamicObject());
+                    point->setProperty("i", inst);
+                    point->setProperty("s", step);
+                    point->setProperty("f", flam);
+                    point->setProperty("m", offset);
+                    timing.add(juce::var(point.get()));
+                }
+            }
+            patt->setProperty("timing", juce::var(timing));
+
+            juce::Array<juce::var> tempo;
+            for (auto active = pattern.grid.getTempoMask(); active != 0; active &= active - 1)
+            {
+                const int step = StepBits::lowest(active);
+                float value = 0.0f;
+                pattern.grid.getTempoPoint(step, value);
+
+                juce::DynamicObject::Ptr point(new juce::DynamicObject());
+                point->setProperty("s", step);
+                point->setProperty("b", value);
+                tempo.add(juce::var(point.get()));
+            }
+            patt->setProperty("tempo", juce::var(tempo));
+            return juce::var(patt.get());
+        }
+
+        bool fromVar(const juce::var& value, PatternData& pattern)
+        {
+            if (!value.isObject())
+                return false;
+
+            auto* obj = value.getDynamicObject();
+            pattern.name = obj->getProperty("name").toString();
+            pattern.bpm = (float)obj->getProperty("bpm");
+            pattern.shuffle = (float)obj->getProperty("shuffle");
+            pattern.accent = (float)obj->getProperty("accent");
+            pattern.flamMs = obj->hasProperty("flamMs") ? (float)obj->getProperty("flamMs") : 20.0f;
+
+            auto stepsStr = obj->getProperty("steps").toString();
+            int idx = 0;
+            pattern.grid = {};
+            for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+            {
+                for (int step = 0; step < patternSteps; ++step)
+                {
+                    StepState state = StepState::Off;
+                    if (idx < stepsStr.length())
+                    {
+                        auto c = stepsStr[(int)idx++];
+                        if (c == '1') state = StepState::On;
+                        else if (c == '2') state = StepState::Accent;
+                    }
+                    pattern.grid.setStep((Instrument)inst, step, state);
+                }
+            }
+
+            auto autoVar = obj->getProperty("automation");
+            if (autoVar.isArray())
+            {
+                auto* autoArr = autoVar.getArray();
+                for (int i = 0; i < autoArr->size(); ++i)
+                {
+                    auto pointVar = autoArr->getReference(i);
+                    if (!pointVar.isObject())
+                        continue;
+
+                    auto* point = pointVar.getDynamicObject();
+                    const int inst = (int)point->getProperty("i");
+                    const int param = (int)point->getProperty("p");
+                    const int step = (int)point->getProperty("s");
+                    const float pointValue = (float)point->getProperty("v");
+
+                    if (inst < 0 || inst >= (int)Instrument::Count
+                        || param < 0 || param >= (int)AutomationParam::Count
+                        || step < 0 || step >= patternSteps)
+                        continue;
+
+                    pattern.grid.setAutomationPoint((Instrument)inst, (AutomationParam)param, step, pointValue);
+                }
+            }
+
+            auto tempoVar = obj->getProperty("tempo");
+            if (tempoVar.isArray())
+            {
+                auto* tempoArr = tempoVar.getArray();
+                for (int i = 0; i < tempoArr->size(); ++i)
+                {
+                    auto pointVar = tempoArr->getReference(i);
+                    if (!pointVar.isObject())
+                        continue;
+
+                    auto* point = pointVar.getDynamicObject();
+                    const int step = (int)point->getProperty("s");
+                    if (step < 0 || step >= patternSteps)
+                        continue;
+
+                    pattern.grid.setTempoPoint(step, (float)point->getProperty("b"));
+                }
+            }
+
+            auto timingVar = obj->getProperty("timing");
+            if (timingVar.isArray())
+            {
+                auto* timingArr = timingVar.getArray();
+                for (int i = 0; i < timingArr->size(); ++i)
+                {
+                    auto pointVar = timingArr->getReference(i);
+                    if (!pointVar.isObject())
+                        continue;
+
+                    auto* point = pointVar.getDynamicObject();
+                    const int inst = (int)point->getProperty("i");
+                    const int step = (int)point->getProperty("s");
+                    if (inst < 0 || inst >= (int)Instrument::Count || step < 0 || step >= patternSteps)
+                        continue;
+
+                    pattern.grid.setFlam((Instrument)inst, step, (bool)point->getProperty("f"));
+                    pattern.grid.setMicrotiming((Instrument)inst, step, (float)point->getProperty("m"));
+                }
+            }
+
+            return true;
+        }
+
+        bool readBankFile(const juce::File& file, juce::Array<PatternData>& patterns)
+        {
+            if (!file.existsAsFile())
+                return false;
+
+            const auto json = juce::JSON::parse(file);
+            if (!isBankJson(json))
+                return false;
+
+            for (const auto& bankVar : *json.getDynamicObject()->getProperty("banks").getArray())
+            {
+                for (const auto& pattVar : *bankVar.getArray())
+                {
+                    PatternData pattern;
+                    if (fromVar(pattVar, pattern))
+                        patterns.add(pattern);
+                }
+            }
+
+            return true;
+        }
+
+        bool writeBankFile(const juce::File& file, const juce::Array<PatternData>& patterns)
+        {
+            juce::Array<juce::var> banksVar;
+            for (int first = 0; first < patterns.size(); first += patternsPerBank)
+            {
+                juce::Array<juce::var> pattVar;
+                for (int p = first; p < juce::jmin(patterns.size(), first + patternsPerBank); ++p)
+                    pattVar.add(toVar(patterns.getReference(p)));
+                banksVar.add(juce::var(pattVar));
+            }
+
+            juce::DynamicObject::Ptr root(new juce::DynamicObject());
+            root->setProperty("banks", juce::var(banksVar));
+            return file.replaceWithText(juce::JSON::toString(juce::var(root.get())));
+        }
+
+        juce::MidiFile toMidiFile(const juce::Array<PatternData>& patterns)
+        {
+            juce::MidiMessageSequence conductor;
+            juce::MidiMessageSequence drums;
+            conductor.addEvent(juce::MidiMessage::timeSignatureMetaEvent(4, 4), 0.0);
+            drums.addEvent(juce::MidiMessage::textMetaEvent(3, "Drums"), 0.0);
+
+            for (int index = 0; index < patterns.size(); ++index)
+            {
+                const auto& pattern = patterns.getReference(index);
+                const double start = (double)index * ticksPerPattern;
+
+                // The pattern's own tempo first, so a tempo point on step 0 lands after it.
+                conductor.addEvent(juce::MidiMessage::textMetaEvent(6, pattern.name), start);
+                conductor.addEvent(juce::MidiMessage::textMetaEvent(1, settingsText(pattern)), start);
+                conductor.addEvent(juce::MidiMessage::tempoMetaEvent(tempoToMicroseconds(pattern.bpm)), start);
+                for (auto active = pattern.grid.getTempoMask(); active != 0; active &= active - 1)
+                {
+                    const int step = StepBits::lowest(active);
+                    float bpm = 0.0f;
+                    pattern.grid.getTempoPoint(step, bpm);
+                    conductor.addEvent(juce::MidiMessage::tempoMetaEvent(tempoToMicroseconds(bpm)), start + step * ticksPerStep);
+                }
+
+                const double flamTicks = pattern.flamMs * 0.001 * pattern.bpm / 60.0 * ticksPerQuarter;
+                for (int track = 0; track < builtInTracks; ++track)
+                {
+                    const auto drum = (Instrument)track;
+                    const int note = noteForDrum(drum);
+                    const auto& lanes = pattern.grid.getLanes(drum);
+                    for (auto on = lanes.on & StepBits::lengthMask(patternSteps); on != 0; on &= on - 1)
+                    {
+                        const int step = StepBits::lowest(on);
+                        const int velocity = (lanes.accent & StepBits::bit(step)) != 0 ? accentVelocity : normalVelocity;
+                        const double time = juce::jmax(0.0, start + (step + pattern.grid.getMicrotiming(drum, step)) * ticksPerStep);
+
+                        if ((lanes.flam & StepBits::bit(step)) != 0)
+                        {
+                            const double graceTime = juce::jmax(0.0, time - flamTicks);
+                            drums.addEvent(juce::MidiMessage::noteOn(drumChannel, note, (juce::uint8)juce::roundToInt(velocity * graceVelocityScale)), graceTime);
+                            drums.addEvent(juce::MidiMessage::noteOff(drumChannel, note), graceTime + 1.0);
+                        }
+
+                        drums.addEvent(juce::MidiMessage::noteOn(drumChannel, note, (juce::uint8)velocity), time);
+                        drums.addEvent(juce::MidiMessage::noteOff(drumChannel, note), time + ticksPerStep / 2);
+                    }
+
+                    for (int param = 0; param < (int)AutomationParam::Count; ++param)
+                    {
+                        for (auto active = pattern.grid.getAutomationMask(drum, (AutomationParam)param); active != 0; active &= active - 1)
+                        {
+                            const int step = StepBits::lowest(active);
+                            float value = 0.0f;
+                            pattern.grid.getAutomationPoint(drum, (AutomationParam)param, step, value);
+                            drums.addEvent(juce::MidiMessage::controllerEvent(automationChannel(track), firstAutomationCC + param,
+                                                                              juce::roundToInt(value * 127.0f)),
+                                           start + step * ticksPerStep);
+                        }
+                    }
+                }
+            }
+
+            const double end = (double)patterns.size() * ticksPerPattern;
+            drums.sort();
+            drums.updateMatchedPairs();
+            conductor.addEvent(juce::MidiMessage::endOfTrack(), end);
+            drums.addEvent(juce::MidiMessage::endOfTrack(), end);
+
+            juce::MidiFile midi;
+            midi.setTicksPerQuarterNote(ticksPerQuarter);
+            midi.addTrack(conductor);
+            midi.addTrack(drums);
+            return midi;
+        }
+
+        bool fromMidiFile(const juce::MidiFile& midi, juce::Array<PatternData>& patterns)
+        {
+            const int timeFormat = midi.getTimeFormat();
+            if (timeFormat <= 0)
+                return false; // SMPTE time has no bars to split patterns on
+
+            const double stepsPerTick = 4.0 / timeFormat;
+            juce::Array<PatternData> imported;
+            auto patternAt = [&imported](double step) -> PatternData&
+            {
+                const int index = juce::jmax(0, (int)std::floor(step / patternSteps));
+                while (imported.size() <= index)
+                    imported.add({});
+                return imported.getReference(index);
+            };
+
+            std::vector<ImportedHit> hits[builtInTracks];
+            juce::Array<std::pair<double, float>> tempos;
+
+            for (int t = 0; t < midi.getNumTracks(); ++t)
+            {
+                const auto* sequence = midi.getTrack(t);
+                for (int e = 0; e < sequence->getNumEvents(); ++e)
+                {
+                    const auto& message = sequence->getEventPointer(e)->message;
+                    const double step = message.getTimeStamp() * stepsPerTick;
+
+                    if (message.isNoteOn())
+                    {
+                        const auto drum = drumForNote(message.getNoteNumber());
+                        if (drum != Instrument::Count)
+                            hits[(int)drum].push_back({ step, (int)message.getVelocity() });
+                    }
+                    else if (message.isController())
+                    {
+                        const int track = trackForAutomationChannel(message.getChannel());
+                        const int param = message.getControllerNumber() - firstAutomationCC;
+                        if (track < 0 || track >= builtInTracks || param < 0 || param >= (int)AutomationParam::Count)
+                            continue;
+
+                        const int gridStep = juce::roundToInt(step);
+                        patternAt(gridStep).grid.setAutomationPoint((Instrument)track, (AutomationParam)param, gridStep % patternSteps,
+                                                                     message.getControllerValue() / 127.0f);
+                    }
+                    else if (message.isTempoMetaEvent())
+                    {
+                        tempos.add({ step, (float)(60.0 / message.getTempoSecondsPerQuarterNote()) });
+                    }
+                    else if (message.isTextMetaEvent())
+                    {
+                        const auto text = message.getTextFromTextMetaEvent();
+                        if (message.getMetaEventType() == 6)
+                            patternAt(step).name = text;
+                        else if (message.getMetaEventType() == 1)
+                            parseSettingsText(text, patternAt(step));
+                    }
+                }
+            }
+
+            // Grace notes: a softer hit of the same drum less than half a step ahead of the next.
+            for (int track = 0; track < builtInTracks; ++track)
+            {
+                auto& list = hits[track];
+                std::stable_sort(list.begin(), list.end(), [](const ImportedHit& a, const ImportedHit& b) { return a.step < b.step; });
+
+                for (size_t i = 0; i < list.size(); ++i)
+                {
+                    const bool isGrace = i + 1 < list.size()
+                        && list[i + 1].step - list[i].step < 0.5
+                        && list[i].velocity < list[i + 1].velocity;
+                    if (isGrace)
+                        continue;
+
+                    const bool flammed = i > 0
+                        && list[i].step - list[i - 1].step < 0.5
+                        && list[i - 1].velocity < list[i].velocity;
+                    const int gridStep = juce::roundToInt(list[i].step);
+                    const int step = gridStep % patternSteps;
+                    auto& grid = patternAt(gridStep).grid;
+                    const auto drum = (Instrument)track;
+                    const bool accent = list[i].velocity > (normalVelocity + accentVelocity) / 2;
+
+                    grid.setStep(drum, step, accent ? StepState::Accent : StepState::On);
+                    grid.setMicrotiming(drum, step, (float)(list[i].step - gridStep));
+                    grid.setFlam(drum, step, flammed);
+                }
+            }
+
+            // The first tempo in each pattern's opening step is its BPM; everything after that
+            // is tempo automation. Patterns without one keep the tempo that was running.
+            std::stable_sort(tempos.begin(), tempos.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            float runningBpm = 120.0f;
+            int tempoIndex = 0;
+            for (int index = 0; index < imported.size(); ++index)
+            {
+                auto& pattern = imported.getReference(index);
+                pattern.bpm = runningBpm;
+                bool hasBpm = false;
+
+                for (; tempoIndex < tempos.size(); ++tempoIndex)
+                {
+                    const auto& tempo = tempos.getReference(tempoIndex);
+                    const int gridStep = juce::roundToInt(tempo.first);
+                    if (gridStep >= (index + 1) * patternSteps)
+                        break;
+
+                    const float bpm = juce::jlimit(40.0f, 200.0f, tempo.second);
+                    const int step = gridStep - index * patternSteps;
+                    if (step == 0 && !hasBpm)
+                        pattern.bpm = bpm;
+                    else
+                        pattern.grid.setTempoPoint(juce::jmax(0, step), bpm);
+
+                    hasBpm = hasBpm || step == 0;
+                    runningBpm = bpm;
+                }
+            }
+
+            for (int index = 0; index < imported.size(); ++index)
+                if (imported.getReference(index).name.isEmpty())
+                    imported.getReference(index).name = "MIDI " + juce::String(index + 1).paddedLeft('0', 2);
+
+            patterns.addArray(imported);
+            return !imported.isEmpty();
+        }
+
+        bool readMidiFile(const juce::File& file, juce::Array<PatternData>& patterns)
+        {
+            juce::FileInputStream stream(file);
+            juce::MidiFile midi;
+            if (!stream.openedOk() || !midi.readFrom(stream))
+                return false;
+            return fromMidiFile(midi, patterns);
+        }
+
+        bool writeMidiFile(const juce::File& file, const juce::Array<PatternData>& patterns)
+        {
+            auto midi = toMidiFile(patterns);
+            juce::FileOutputStream stream(file);
+            if (!stream.openedOk())
+                return false;
+
+            stream.setPosition(0);
+            stream.truncate();
+            return midi.writeTo(stream);
+        }
+
+        int noteForDrum(Instrument instrument)
+        {
+            switch (instrument)
+            {
+                case Instrument::Kick:      return 36;
+                case Instrument::Snare:     return 38;
+                case Instrument::Clap:      return 39;
+                case Instrument::Rim:       return 37;
+                case Instrument::TomLow:    return 41;
+                case Instrument::TomMid:    return 45;
+                case Instrument::TomHigh:   return 48;
+                case Instrument::ClosedHat: return 42;
+                case Instrument::OpenHat:   return 46;
+                case Instrument::Crash:     return 49;
+                case Instrument::Ride:      return 51;
+                default: break;
+            }
+            return -1;
+        }
+
+        Instrument drumForNote(int note)
+        {
+            // General MIDI drum map, which most pad controllers and DAW drum racks use.
+            switch (note)
+            {
+                case 35: case 36:           return Instrument::Kick;
+                case 37:                    return Instrument::Rim;
+                case 38: case 40:           return Instrument::Snare;
+                case 39:                    return Instrument::Clap;
+                case 41: case 43:           return Instrument::TomLow;
+                case 45: case 47:           return Instrument::TomMid;
+                case 48: case 50:           return Instrument::TomHigh;
+                case 42: case 44:           return Instrument::ClosedHat;
+                case 46:                    return Instrument::OpenHat;
+                case 49: case 57:           return Instrument::Crash;
+                case 51: case 59:           return Instrument::Ride;
+                default: break;
+            }
+            return Instrument::Count;
+        }
+
+        bool parseChain(const juce::String& text, juce::Array<int>& indices)
+        {
+            for (auto id : juce::StringArray::fromTokens(text, ",", ""))
+            {
+                id = id.trim().toUpperCase().removeCharacters("-");
+                const auto letter = id.containsAnyOf("AB") ? id.retainCharacters("AB") : juce::String();
+                const int number = id.retainCharacters("0123456789").getIntValue();
+                if (letter.length() != 1 || number < 1 || number > patternsPerBank)
+                    return false;
+
+                indices.add((letter[0] - 'A') * patternsPerBank + number - 1);
+            }
+            return !indices.isEmpty();
+        }
+
+        juce::StringArray convertFiles(const juce::Array<juce::File>& inputs, const juce::File& outputDir,
+                                       const juce::Array<int>& chain, int numThreads)
+        {
+            juce::StringArray failures;
+            juce::CriticalSection failureLock;
+            auto fail = [&failures, &failureLock](const juce::File& file, const juce::String& reason)
+            {
+                const juce::ScopedLock sl(failureLock);
+                failures.add(file.getFullPathName() + ": " + reason);
+            };
+
+            // Folders may hold any JSON, so only their pattern banks are taken; a file named
+            // on its own is converted or reported.
+            juce::Array<juce::File> files;
+            for (const auto& input : inputs)
+            {
+                if (!input.isDirectory())
+                {
+                    files.addIfNotAlreadyThere(input);
+                    continue;
+                }
+
+                for (const auto& found : input.findChildFiles(juce::File::findFiles, true, "*.mid;*.midi;*.json"))
+                    if (!found.hasFileExtension("json") || isBankFile(found))
+                        files.addIfNotAlreadyThere(found);
+            }
+
+            juce::Array<ConvertJob> jobs;
+            for (const auto& file : files)
+            {
+                const auto dir = outputDir == juce::File() ? file.getParentDirectory() : outputDir;
+                ConvertJob job;
+                job.input = file;
+                if (file.hasFileExtension("mid;midi"))
+                    job.output = dir.getChildFile(file.getFileNameWithoutExtension() + ".json");
+                else if (!chain.isEmpty())
+                    job.output = dir.getChildFile(file.getFileNameWithoutExtension() + "-chain.mid");
+                else
+                {
+                    job.output = dir.getChildFile(file.getFileNameWithoutExtension());
+                    job.perBank = true;
+                }
+                jobs.add(job);
+            }
+
+            // Jobs run in parallel, so none may write a file another job reads, or one another
+            // job writes too. Those are left out and reported rather than run in some order.
+            juce::Array<ConvertJob> runnable;
+            for (const auto& job : jobs)
+            {
+                juce::String clash;
+                for (const auto& other : jobs)
+                    if (clash.isEmpty() && &other != &job && job.writes(other.input))
+                        clash = "its output would overwrite " + other.input.getFullPathName() + ", which is converted too";
+
+                for (const auto& earlier : runnable)
+                    if (clash.isEmpty() && job.writesSameAs(earlier))
+                        clash = "its output is also written for " + earlier.input.getFullPathName();
+
+                if (clash.isNotEmpty())
+                    fail(job.input, clash);
+                else
+                    runnable.add(job);
+            }
+
+            auto convertOne = [&chain, &fail](const ConvertJob& job)
+            {
+                const auto& file = job.input;
+                juce::Array<PatternData> patterns;
+
+                if (file.hasFileExtension("mid;midi"))
+                {
+                    if (job.output.existsAsFile() && !isBankFile(job.output))
+                        fail(file, "would overwrite " + job.output.getFileName() + ", which is not a pattern bank file");
+                    else if (!readMidiFile(file, patterns))
+                        fail(file, "not a readable MIDI file with drum notes");
+                    else if (!writeBankFile(job.output, patterns))
+                        fail(file, "could not write the bank file");
+                    return;
+                }
+
+                if (!readBankFile(file, patterns))
+                {
+                    fail(file, "not a pattern bank file");
+                    return;
+                }
+
+                if (!job.perBank)
+                {
+                    juce::Array<PatternData> chained;
+                    for (const int index : chain)
+                        if (juce::isPositiveAndBelow(index, patterns.size()))
+                            chained.add(patterns.getReference(index));
+
+                    if (chained.isEmpty() || !writeMidiFile(job.output, chained))
+                        fail(file, "could not write the chain");
+                    return;
+                }
+
+                for (int first = 0; first < patterns.size(); first += patternsPerBank)
+                {
+                    juce::Array<PatternData> bank;
+                    for (int p = first; p < juce::jmin(patterns.size(), first + patternsPerBank); ++p)
+                        bank.add(patterns.getReference(p));
+
+                    const auto name = job.output.getFileName() + "-" + juce::String::charToString((juce::juce_wchar)('A' + first / patternsPerBank));
+                    if (!writeMidiFile(job.output.getSiblingFile(name + ".mid"), bank))
+                        fail(file, "could not write " + name + ".mid");
+                }
+            };
+
+            // One pool for the whole batch; the last job to finish wakes this thread.
+            std::atomic<int> remaining { runnable.size() };
+            juce::WaitableEvent finished;
+            juce::ThreadPool pool(juce::jmax(1, numThreads));
+            for (const auto& job : runnable)
+            {
+                pool.addJob([convertOne, job, &remaining, &finished]
+                {
+                    convertOne(job);
+                    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        finished.signal();
+                });
+            }
+
+            if (!runnable.isEmpty())
+                finished.wait();
+
+            failures.sort(true);
+            return failures;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Pattern.h"
+
+namespace rb338
+{
+    // A stored pattern with the settings that travel with it.
+    struct PatternData
+    {
+        PatternGrid grid;
+        float bpm = 120.0f;
+        float shuffle = 0.0f;
+        float accent = 0.5f;
+        float flamMs = 20.0f;
+        juce::String name;
+    };
+
+    // Moving patterns in and out of the app: the bank JSON it stores them in, and Standard MIDI
+    // Files for DAWs.
+    //
+    // In a MIDI file each pattern is one 4/4 bar of sixteenth steps, one after the other, so a
+    // single pattern, a bank or a chain all read as a song. The kit plays GM drum notes on
+    // channel 10: accents are velocity 127, flams a softer grace note ahead of the hit, and
+    // microtiming the note's distance from the grid. Knob automation is CC 20-24 (level, tune,
+    // decay, tone, snappy) on a channel per drum, tempo and tempo automation are tempo events,
+    // and each pattern's name and settings ride along as a marker and a text event.
+    namespace PatternIO
+    {
+        static constexpr int patternsPerBank = 16;
+        static constexpr int patternSteps = 16;
+        static constexpr int ticksPerQuarter = 480;
+
+        juce::var toVar(const PatternData& pattern);
+        bool fromVar(const juce::var& value, PatternData& pattern);
+
+        // Bank files hold banks of patternsPerBank patterns; reading flattens them in order.
+        bool readBankFile(const juce::File& file, juce::Array<PatternData>& patterns);
+        bool writeBankFile(const juce::File& file, const juce::Array<PatternData>& patterns);
+
+        juce::MidiFile toMidiFile(const juce::Array<PatternData>& patterns);
+        bool fromMidiFile(const juce::MidiFile& midi, juce::Array<PatternData>& patterns);
+        bool readMidiFile(const juce::File& file, juce::Array<PatternData>& patterns);
+        bool writeMidiFile(const juce::File& file, const juce::Array<PatternData>& patterns);
+
+        int noteForDrum(Instrument instrument);
+        Instrument drumForNote(int note); // Instrument::Count for notes outside the GM drum map
+
+        // Pattern ids as shown in the app ("A01", "01-A" or "a1"), comma separated, as indices
+        // into a flattened bank file. Returns false if any id does not parse.
+        bool parseChain(const juce::String& text, juce::Array<int>& indices);
+
+        // Headless conversion. MIDI files become bank files, and bank files become one MIDI file
+        // per bank, or a single file when a chain is given. Directories are searched recursively,
+        // taking only the JSON files that are pattern banks. Output goes to outputDir, or next to
+        // each input when outputDir is empty. Files convert in parallel, so a file whose output
+        // would overwrite another input, or another file's output, is skipped; so is a MIDI file
+        // whose bank file would replace a JSON file that is not a bank. The result holds one line
+        // per file that failed or was skipped.
+        juce::StringArray convertFiles(const juce::Array<juce::File>& inputs, const juce::File& outputDir,
+                                       const juce::Array<int>& chain, int numThreads);
+    }
+}
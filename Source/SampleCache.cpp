@@ -0,0 +1,178 @@
+#include "SampleCache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace rb338
+{
+    // Followed directly by the samples as native floats, one channel after the other. 64 bytes,
+    // so the samples start aligned in the mapping.
+    struct SampleCache::Header
+    {
+        char magic[4];
+        juce::uint32 format;
+        juce::int64 generator;
+        double sampleRate;
+        float params[4];
+        juce::int32 model;
+        juce::int32 numSamples;
+        juce::int32 numChannels;
+        char reserved[12];
+    };
+
+    static constexpr juce::uint32 cacheFormat = 2;
+    static constexpr int maxCacheChannels = 2;
+
+    static void packParams(const SampleCache::Key& key, float (&params)[4])
+    {
+        params[0] = key.params.tune;
+        params[1] = key.params.decay;
+        params[2] = key.params.tone;
+        params[3] = key.params.snappy;
+    }
+
+    SampleCache::SampleCache(const juce::File& cacheDirectory, juce::int64 maxCacheBytes)
+        : directory(cacheDirectory), maxBytes(maxCacheBytes)
+    {
+    }
+
+    juce::File SampleCache::getDefaultDirectory()
+    {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("LoS9x9")
+            .getChildFile("SampleCache");
+    }
+
+    juce::File SampleCache::fileFor(const Key& key) const
+    {
+        float params[4];
+        packParams(key, params);
+
+        juce::String name;
+        name << (int)key.model << ":" << juce::String(key.sampleRate, 3) << ":" << juce::String(key.generator);
+        for (auto value : params)
+        {
+            juce::uint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            name << ":" << juce::String::toHexString((int)bits);
+        }
+
+        return directory.getChildFile(juce::String::toHexString(name.hashCode64()) + ".smp");
+    }
+
+    bool SampleCache::load(const Key& key, Sample& sample) const
+    {
+        const auto file = fileFor(key);
+        if (!file.existsAsFile())
+            return false;
+
+        auto mapping = std::make_shared<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+        const auto* bytes = static_cast<const char*>(mapping->getData());
+        if (bytes == nullptr || mapping->getSize() < sizeof(Header))
+            return false;
+
+        Header header;
+        std::memcpy(&header, bytes, sizeof(header));
+
+        float params[4];
+        packParams(key, params);
+        if (std::memcmp(header.magic, "L9SC", 4) != 0 || header.format != cacheFormat
+            || header.generator != key.generator || header.sampleRate != key.sampleRate
+            || header.model != (juce::int32)key.model || std::memcmp(header.params, params, sizeof(params)) != 0
+            || header.numSamples <= 0 || header.numChannels < 1 || header.numChannels > maxCacheChannels
+            || mapping->getSize() != sizeof(Header) + (size_t)header.numChannels * (size_t)header.numSamples * sizeof(float))
+            return false;
+
+        // Voices only ever read a sample, so the read-only mapping can back the buffer directly.
+        auto* first = const_cast<float*>(reinterpret_cast<const float*>(bytes + sizeof(Header)));
+        float* channels[maxCacheChannels];
+        for (int channel = 0; channel < header.numChannels; ++channel)
+            channels[channel] = first + (size_t)channel * (size_t)header.numSamples;
+
+        sample.data = juce::AudioBuffer<float>(channels, header.numChannels, header.numSamples);
+        sample.sampleRate = key.sampleRate;
+        sample.mapping = std::move(mapping);
+
+        file.setLastAccessTime(juce::Time::getCurrentTime());
+        return true;
+    }
+
+    void SampleCache::store(const Key& key, const Sample& sample)
+    {
+        const int numSamples = sample.data.getNumSamples();
+        const int numChannels = sample.data.getNumChannels();
+        if (numChannels < 1 || numChannels > maxCacheChannels || numSamples <= 0)
+            return;
+
+        static_assert(sizeof(Header) == 64, "the samples must start aligned");
+
+        Header header {};
+        std::memcpy(header.magic, "L9SC", 4);
+        header.format = cacheFormat;
+        header.generator = key.generator;
+        header.sampleRate = key.sampleRate;
+        packParams(key, header.params);
+        header.model = (juce::int32)key.model;
+        header.numSamples = numSamples;
+        header.numChannels = numChannels;
+
+        if (directory.createDirectory().failed())
+            return;
+
+        // Written next to the target and moved over it, so a reader never maps half a file.
+        const auto file = fileFor(key);
+        juce::TemporaryFile temp(file);
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk() || !out.write(&header, sizeof(header)))
+                return;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                if (!out.write(sample.data.getReadPointer(channel), (size_t)numSamples * sizeof(float)))
+                    return;
+        }
+
+        // A key stored again replaces its file, so only the difference is counted.
+        const juce::ScopedLock sl(lock);
+        const auto replacedBytes = file.getSize();
+        if (!temp.overwriteTargetFileWithTemporary())
+            return;
+
+        if (bytesStored < 0)
+        {
+            bytesStored = 0;
+            for (const auto& cached : directory.findChildFiles(juce::File::findFiles, false, "*.smp"))
+                bytesStored += cached.getSize();
+        }
+        else
+        {
+            bytesStored += file.getSize() - replacedBytes;
+        }
+
+        if (bytesStored > maxBytes)
+            evict();
+    }
+
+    void SampleCache::evict()
+    {
+        auto files = directory.findChildFiles(juce::File::findFiles, false, "*.smp");
+        std::sort(files.begin(), files.end(), [](const juce::File& a, const juce::File& b)
+        {
+            return a.getLastAccessTime() < b.getLastAccessTime();
+        });
+
+        // Down to three quarters of the limit, so the next few stores don't all scan again.
+        bytesStored = 0;
+        for (const auto& file : files)
+            bytesStored += file.getSize();
+
+        for (const auto& file : files)
+        {
+            if (bytesStored <= maxBytes * 3 / 4)
+                break;
+
+            const auto size = file.getSize();
+            if (file.deleteFile())
+                bytesStored -= size;
+        }
+    }
+}
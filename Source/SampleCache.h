@@ -0,0 +1,45 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Samples.h"
+
+namespace rb338
+{
+    // Rendered sounds kept on disk between runs, so launching, changing device or recalling a
+    // kit maps in sounds made before instead of synthesising them again.
+    //
+    // Each sound is one file named after its key: model, parameters, sample rate and a
+    // fingerprint of what the synthesis code puts out and whatever else the render read, so a
+    // build whose generators changed or a different reference sample never picks up a stale sound. A hit is memory mapped and played straight
+    // from the mapping. Once the files outgrow the size limit the least recently used go.
+    // Safe to use from any thread.
+    class SampleCache
+    {
+    public:
+        struct Key
+        {
+            Instrument model = Instrument::Kick;
+            InstrumentParams params;
+            double sampleRate = 44100.0;
+            juce::int64 generator = 0;
+        };
+
+        SampleCache(const juce::File& directory, juce::int64 maxBytes);
+
+        bool load(const Key& key, Sample& sample) const;
+        void store(const Key& key, const Sample& sample);
+
+        static juce::File getDefaultDirectory();
+
+    private:
+        struct Header;
+
+        const juce::File directory;
+        const juce::int64 maxBytes;
+        juce::CriticalSection lock;
+        juce::int64 bytesStored = -1; // under lock; -1 until the directory has been measured
+
+        juce::File fileFor(const Key& key) const;
+        void evict();
+    };
+}
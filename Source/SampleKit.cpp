@@ -0,0 +1,310 @@
+#include "SampleKit.h"
+#include <algorithm>
+#include <cstring>
+
+namespace rb338
+{
+    // The manifest: this header, one entry per sound, then the kit's name in UTF-8. Each sound's
+    // channels follow one after the other, starting on a 64 byte boundary.
+    struct SampleKit::Header
+    {
+        char magic[4];
+        juce::uint32 format;
+        juce::int32 numEntries;
+        juce::int32 nameBytes;
+        char reserved[48];
+    };
+
+    struct SampleKit::Entry
+    {
+        juce::int32 instrument;
+        juce::int32 numChannels;
+        juce::int32 numSamples;
+        juce::int32 reserved;
+        double sampleRate;
+        juce::int64 offset; // from the start of the file
+    };
+
+    static constexpr juce::uint32 kitFormat = 1;
+    static constexpr int maxKitChannels = 2;
+    static constexpr size_t soundAlignment = 64;
+    static constexpr size_t pageBytes = 4096;
+
+    static size_t alignSound(size_t offset)
+    {
+        return (offset + soundAlignment - 1) / soundAlignment * soundAlignment;
+    }
+
+    std::unique_ptr<SampleKit> SampleKit::open(const juce::File& kitFile)
+    {
+        auto kitMapping = std::make_shared<juce::MemoryMappedFile>(kitFile, juce::MemoryMappedFile::readOnly);
+        const auto* bytes = static_cast<const char*>(kitMapping->getData());
+        const auto size = kitMapping->getSize();
+        if (bytes == nullptr || size < sizeof(Header))
+            return nullptr;
+
+        Header header;
+        std::memcpy(&header, bytes, sizeof(header));
+        if (std::memcmp(header.magic, "L9KT", 4) != 0 || header.format != kitFormat
+            || header.numEntries < 0 || header.numEntries > (int)Instrument::Count || header.nameBytes < 0)
+            return nullptr;
+
+        const auto manifestBytes = sizeof(Header) + (size_t)header.numEntries * sizeof(Entry);
+        if (size < manifestBytes + (size_t)header.nameBytes)
+            return nullptr;
+
+        auto kit = std::make_unique<SampleKit>();
+        kit->file = kitFile;
+        kit->name = juce::String::fromUTF8(bytes + manifestBytes, header.nameBytes);
+
+        for (int i = 0; i < header.numEntries; ++i)
+        {
+            Entry entry;
+            std::memcpy(&entry, bytes + sizeof(Header) + (size_t)i * sizeof(Entry), sizeof(entry));
+
+            if (entry.instrument < 0 || entry.instrument >= (int)Instrument::Count
+                || entry.numChannels < 1 || entry.numChannels > maxKitChannels
+                || entry.numSamples <= 0 || !(entry.sampleRate > 0.0)
+                || entry.offset < (juce::int64)manifestBytes || (size_t)entry.offset % soundAlignment != 0
+                || (juce::uint64)entry.offset + (juce::uint64)entry.numChannels * (juce::uint64)entry.numSamples * sizeof(float) > size)
+                return nullptr;
+
+            // Voices only ever read a sound, so the read-only mapping can back the buffer directly.
+            auto* first = const_cast<float*>(reinterpret_cast<const float*>(bytes + entry.offset));
+            float* channels[maxKitChannels];
+            for (int channel = 0; channel < entry.numChannels; ++channel)
+                channels[channel] = first + (size_t)channel * (size_t)entry.numSamples;
+
+            auto& sound = kit->sounds[(size_t)entry.instrument];
+            sound.data = juce::AudioBuffer<float>(channels, entry.numChannels, entry.numSamples);
+            sound.sampleRate = entry.sampleRate;
+            sound.mapping = kitMapping;
+        }
+
+        // Brings every page in now, on the thread selecting the kit, rather than on the first hit.
+        volatile char touched = 0;
+        for (size_t offset = 0; offset < size; offset += pageBytes)
+            touched = (char)(touched + bytes[offset]);
+
+        kit->mapping = std::move(kitMapping);
+        return kit;
+    }
+
+    bool SampleKit::write(const juce::File& kitFile, const juce::String& kitName, const Sounds& kitSounds)
+    {
+        static_assert(sizeof(Header) == 64 && sizeof(Entry) == 32, "the manifest layout is part of the file format");
+
+        std::array<Entry, (size_t)Instrument::Count> entries {};
+        int numEntries = 0;
+        for (size_t i = 0; i < kitSounds.size(); ++i)
+        {
+            const auto* sound = kitSounds[i];
+            if (sound == nullptr || sound->data.getNumChannels() < 1 || sound->data.getNumSamples() <= 0)
+                continue;
+
+            auto& entry = entries[(size_t)numEntries++];
+            entry.instrument = (juce::int32)i;
+            entry.numChannels = juce::jmin(maxKitChannels, sound->data.getNumChannels());
+            entry.numSamples = sound->data.getNumSamples();
+            entry.sampleRate = sound->sampleRate;
+        }
+
+        if (numEntries == 0)
+            return false;
+
+        Header header {};
+        std::memcpy(header.magic, "L9KT", 4);
+        header.format = kitFormat;
+        header.numEntries = numEntries;
+        header.nameBytes = (juce::int32)kitName.getNumBytesAsUTF8();
+
+        auto offset = alignSound(sizeof(Header) + (size_t)numEntries * sizeof(Entry) + (size_t)header.nameBytes);
+        for (int i = 0; i < numEntries; ++i)
+        {
+            auto& entry = entries[(size_t)i];
+            entry.offset = (juce::int64)offset;
+            offset = alignSound(offset + (size_t)entry.numChannels * (size_t)entry.numSamples * sizeof(float));
+        }
+
+        if (kitFile.getParentDirectory().createDirectory().failed())
+            return false;
+
+        // Written next to the target and moved over it, so a kit being played is never rewritten.
+        juce::TemporaryFile temp(kitFile);
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk()
+                || !out.write(&header, sizeof(header))
+                || !out.write(entries.data(), (size_t)numEntries * sizeof(Entry))
+                || !out.write(kitName.toRawUTF8(), (size_t)header.nameBytes))
+                return false;
+
+            size_t position = sizeof(Header) + (size_t)numEntries * sizeof(Entry) + (size_t)header.nameBytes;
+            for (int i = 0; i < numEntries; ++i)
+            {
+                const auto& entry = entries[(size_t)i];
+                const auto& data = kitSounds[(size_t)entry.instrument]->data;
+                if (!out.writeRepeatedByte(0, (size_t)entry.offset - position))
+                    return false;
+
+                position = (size_t)entry.offset;
+                for (int channel = 0; channel < entry.numChannels; ++channel)
+                {
+                    if (!out.write(data.getReadPointer(channel), (size_t)entry.numSamples * sizeof(float)))
+                        return false;
+                    position += (size_t)entry.numSamples * sizeof(float);
+                }
+            }
+        }
+
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+    bool SampleKit::writeFromFolder(const juce::File& folder, const juce::File& kitFile)
+    {
+        // Each track's short name first, as the kit shows it, then the usual long names.
+        const juce::StringArray trackAliases[] = {
+            { "bd", "kick", "bassdrum", "bass_drum" },
+            { "sd", "snare", "snaredrum", "snare_drum" },
+            { "cp", "clap", "handclap" },
+            { "rs", "rim", "rimshot" },
+            { "lt", "tom_low", "lowtom", "low_tom" },
+            { "mt", "tom_mid", "midtom", "mid_tom" },
+            { "ht", "tom_high", "hightom", "high_tom" },
+            { "ch", "closedhat", "closed_hat", "hh_closed" },
+            { "oh", "openhat", "open_hat", "hh_open" },
+            { "cr", "crash", "crash_cymbal" },
+            { "rd", "ride", "ride_cymbal" }
+        };
+        static_assert(sizeof(trackAliases) / sizeof(trackAliases[0]) == (size_t)Instrument::Count, "one alias list per track");
+
+        juce::Array<juce::File> index;
+        for (const auto& candidate : folder.findChildFiles(juce::File::findFiles, true, "*"))
+            if (candidate.hasFileExtension("wav;aif;aiff;flac"))
+                index.add(candidate);
+
+        std::array<Sample, (size_t)Instrument::Count> decoded;
+        Sounds kitSounds = {};
+        for (size_t i = 0; i < decoded.size(); ++i)
+        {
+            for (const auto& alias : trackAliases[i])
+            {
+                for (const auto& candidate : index)
+                {
+                    if (candidate.getFileNameWithoutExtension().equalsIgnoreCase(alias) && SampleLibrary::readFile(candidate, decoded[i]))
+                    {
+                        kitSounds[i] = &decoded[i];
+                        break;
+                    }
+                }
+
+                if (kitSounds[i] != nullptr)
+                    break;
+            }
+        }
+
+        return write(kitFile, folder.getFileName(), kitSounds);
+    }
+
+    std::unique_ptr<SampleKit> SampleKit::openAt(const juce::File& kitFile, double sampleRate)
+    {
+        auto kit = open(kitFile);
+        if (kit == nullptr || kit->isAtRate(sampleRate))
+            return kit;
+
+        // Named after the kit file as it is now, so a kit written again is converted again.
+        const auto kitName = juce::String::toHexString(kitFile.getFullPathName().hashCode64());
+        const auto stamp = kitName + "-" + juce::String::toHexString((juce::String(kitFile.getSize()) + ":"
+                                                                      + juce::String(kitFile.getLastModificationTime().toMilliseconds())).hashCode64());
+        const auto copyFile = getConvertedDirectory().getChildFile(stamp + "-" + juce::String(sampleRate, 0) + ".l9kit");
+
+        auto converted = open(copyFile);
+        if (converted == nullptr || !converted->isAtRate(sampleRate))
+        {
+            std::array<Sample, (size_t)Instrument::Count> resampled;
+            Sounds copySounds = {};
+            for (size_t i = 0; i < resampled.size(); ++i)
+            {
+                const auto* sound = kit->getSound((Instrument)i);
+                if (sound == nullptr)
+                    continue;
+
+                if (sound->sampleRate != sampleRate)
+                {
+                    resampled[i] = SampleLibrary::resample(*sound, sampleRate);
+                    sound = &resampled[i];
+                }
+                copySounds[i] = sound;
+            }
+
+            // Copies made from an older version of the kit are no use any more.
+            for (const auto& old : getConvertedDirectory().findChildFiles(juce::File::findFiles, false, kitName + "-*.l9kit"))
+                if (!old.getFileName().startsWith(stamp + "-"))
+                    old.deleteFile();
+
+            converted = write(copyFile, kit->name, copySounds) ? open(copyFile) : nullptr;
+            if (converted == nullptr)
+            {
+                // Nowhere to keep the copy: the kit holds its converted sounds itself this time.
+                for (size_t i = 0; i < resampled.size(); ++i)
+                    if (resampled[i].data.getNumSamples() > 0)
+                        kit->sounds[i] = std::move(resampled[i]);
+                return kit;
+            }
+        }
+
+        converted->file = kitFile;
+        return converted;
+    }
+
+    bool SampleKit::isAtRate(double sampleRate) const
+    {
+        for (const auto& sound : sounds)
+            if (sound.data.getNumSamples() > 0 && sound.sampleRate != sampleRate)
+                return false;
+        return true;
+    }
+
+    juce::Array<juce::File> SampleKit::findKits(const juce::File& directory)
+    {
+        auto kits = directory.findChildFiles(juce::File::findFiles, false, "*.l9kit");
+        std::sort(kits.begin(), kits.end(), [](const juce::File& a, const juce::File& b)
+        {
+            return a.getFileName().compareIgnoreCase(b.getFileName()) < 0;
+        });
+        return kits;
+    }
+
+    juce::File SampleKit::getDefaultDirectory()
+    {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("LoS9x9")
+            .getChildFile("Kits");
+    }
+
+    juce::File SampleKit::getConvertedDirectory()
+    {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("LoS9x9")
+            .getChildFile("ConvertedKits");
+    }
+
+    const Sample* SampleKit::getSound(Instrument instrument) const
+    {
+        if (instrument == Instrument::Count)
+            return nullptr;
+
+        const auto& sound = sounds[(size_t)instrument];
+        return sound.data.getNumSamples() > 0 ? &sound : nullptr;
+    }
+
+    const juce::String& SampleKit::getName() const
+    {
+        return name;
+    }
+
+    const juce::File& SampleKit::getFile() const
+    {
+        return file;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <memory>
+#include "Samples.h"
+
+namespace rb338
+{
+    // A drum kit in one file: a manifest of its sounds, each tagged with the rate it was recorded
+    // at, followed by their samples already decoded to native floats. Opening a kit maps the file
+    // and points every sound at its samples, so nothing is decoded or copied and an open kit
+    // plays straight from the mapping. A default constructed kit has no sounds.
+    class SampleKit
+    {
+    public:
+        using Sounds = std::array<const Sample*, (size_t)Instrument::Count>; // nullptr where a kit has none
+
+        SampleKit() = default;
+
+        // Maps the file and touches every page of it, so the audio thread never faults one in.
+        // nullptr if the file is not a kit this build can read.
+        static std::unique_ptr<SampleKit> open(const juce::File& file);
+        static bool write(const juce::File& file, const juce::String& name, const Sounds& sounds);
+
+        // Decodes the audio files in a folder, named after the kit's tracks ("bd.wav",
+        // "snare.aif", ...), into a kit. False if none of them could be read.
+        static bool writeFromFolder(const juce::File& folder, const juce::File& file);
+
+        // Opens the kit with every sound at sampleRate, so they play at their own pitch. Sounds
+        // recorded at another rate are converted once, into a copy of the kit kept per rate in
+        // getConvertedDirectory; opening it at that rate again maps the copy like any other kit.
+        // The kit reports the original file. nullptr if the file is not a kit.
+        static std::unique_ptr<SampleKit> openAt(const juce::File& file, double sampleRate);
+
+        static juce::Array<juce::File> findKits(const juce::File& directory); // sorted by name
+        static juce::File getDefaultDirectory();
+        static juce::File getConvertedDirectory();
+
+        const Sample* getSound(Instrument instrument) const; // nullptr where the kit has none
+        const juce::String& getName() const;
+        const juce::File& getFile() const;
+
+        juce::uint64 version = 0; // set by the engine when it publishes the kit
+
+    private:
+        struct Header;
+        struct Entry;
+
+        juce::File file;
+        juce::String name;
+        std::shared_ptr<const juce::MemoryMappedFile> mapping; // shared with the sounds, so a copied sound keeps it mapped
+        std::array<Sample, (size_t)Instrument::Count> sounds;
+
+        bool isAtRate(double sampleRate) const;
+    };
+}
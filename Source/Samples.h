@@ -2,6 +2,8 @@
 
 #include <JuceHeader.h>
 #include <array>
+#include <atomic>
+#include <memory>
 
 namespace rb338
 {
@@ -23,8 +25,9 @@ namespace rb338
 
     struct Sample
     {
-        juce::AudioBuffer<float> data;
+        juce::AudioBuffer<float> data; // one channel, or two for a stereo sound
         double sampleRate = 44100.0;
+        std::shared_ptr<const juce::MemoryMappedFile> mapping; // backs data when it came from the disk cache
     };
 
     // Per-instrument parameters (TR-909 style)
@@ -36,29 +39,92 @@ namespace rb338
         float tone = 0.5f;      // 0-1 range
     };
 
+    // How the tonal and metallic oscillators are drawn. Naive is the original shapes, which alias
+    // audibly on the hats below 96 kHz; band-limited smooths their edges so 44.1 and 48 kHz
+    // sound clean.
+    enum class OscillatorQuality
+    {
+        Naive,
+        BandLimited
+    };
+
+    class SampleCache;
+    class ReferencePackLoader;
+
     class SampleLibrary
     {
     public:
-        void prepare(double sampleRate);
-        const Sample& get(Instrument instrument) const;
-        bool loadFromFile(Instrument instrument, const juce::File& file);
-        void regenerate(Instrument instrument, double sampleRate, const InstrumentParams& params);
+        SampleLibrary();
+        ~SampleLibrary();
+
+        struct RenderRequest
+        {
+            Instrument model = Instrument::Kick;
+            InstrumentParams params;
+            Sample result;
+        };
+
+        bool loadFromFile(Instrument instrument, const juce::File& file); // as the model's reference sample
+
+        // The library keeps no rendered sounds itself; whoever plays a render owns it, so it can
+        // never change under a voice. Renders are kept in the disk cache, and come from there
+        // when they have been made before.
+        Sample render(Instrument model, double sampleRate, const InstrumentParams& params) const;
+
+        // Synthesis only, past the disk cache, so the tests and the benchmark measure the
+        // generators themselves. Nothing is stored for next time.
+        Sample renderUncached(Instrument model, double sampleRate, const InstrumentParams& params) const;
+
+        // For the tests and the benchmark: the same generators run on dsp::reference, the closed
+        // forms the fast envelopes and phasors stand in for. Slow, and nothing is cached.
+        Sample renderReference(Instrument model, double sampleRate, const InstrumentParams& params) const;
+        void renderAll(juce::Array<RenderRequest>& requests, double sampleRate) const; // one job per request, on the library's pool
+        static bool readFile(const juce::File& file, Sample& loaded);
+
+        // A copy of the sound at another rate, made with the converter the reference samples go
+        // through. The copy owns its samples.
+        static Sample resample(const Sample& source, double sampleRate);
+
+        // Only while nothing is rendering, e.g. before prepare; sounds rendered already keep
+        // the quality they were made with.
+        void setOscillatorQuality(OscillatorQuality quality);
+        OscillatorQuality getOscillatorQuality() const;
+
+        // The reference pack is found and decoded on a background thread started with the
+        // library, so nothing waits on the disk for it; sounds render without it until then.
+        // installReferencePack moves a finished pack in once the renders in progress are done,
+        // and returns the instruments whose reference changed so their sounds can be rendered again.
+        bool isReferencePackReady() const;
+        juce::Array<Instrument> installReferencePack();
 
     private:
-        Sample samples[(int)Instrument::Count];
         std::array<Sample, (size_t)Instrument::Count> referenceSamples;
         std::array<bool, (size_t)Instrument::Count> hasReferenceSamples = {};
-        void generateDefaults(double sampleRate);
-        void tryLoadReferencePack(double sampleRate);
+        std::array<juce::int64, (size_t)Instrument::Count> referenceStamps = {}; // which file each reference came from
+        std::unique_ptr<SampleCache> diskCache;
+        std::unique_ptr<ReferencePackLoader> referenceLoader; // null once its pack is installed
+        juce::ReadWriteLock referenceLock; // read by every render, written when a reference changes
+        std::unique_ptr<juce::ThreadPool> renderPool; // one thread per core, kept for every renderAll
+        OscillatorQuality oscillatorQuality = OscillatorQuality::BandLimited;
+
+        // A hash of a few short renders per model, made the first time the model goes through
+        // the disk cache, and again after anything the renders read changes. Cached renders are
+        // keyed on it.
+        mutable std::array<std::atomic<juce::int64>, (size_t)Instrument::Count> fingerprints;
+        juce::int64 getFingerprint(Instrument model) const;
+        void resetFingerprints();
+
+        // The generators take the primitives they run on as a parameter; see renderReference.
+        template <typename Primitives> Sample synthesise(Instrument model, double sampleRate, const InstrumentParams& params) const;
         Sample processReferenceSample(Instrument instrument, double sampleRate, const InstrumentParams& params) const;
 
-        Sample generateKick(double sampleRate, const InstrumentParams& params) const;
-        Sample generateSnare(double sampleRate, const InstrumentParams& params) const;
-        Sample generateClap(double sampleRate, const InstrumentParams& params) const;
-        Sample generateRim(double sampleRate, const InstrumentParams& params) const;
-        Sample generateTom(double sampleRate, float baseFreq, const InstrumentParams& params) const;
-        Sample generateHat(double sampleRate, bool open, const InstrumentParams& params) const;
-        Sample generateCrash(double sampleRate, const InstrumentParams& params) const;
-        Sample generateRide(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateKick(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateSnare(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateClap(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateRim(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateTom(double sampleRate, float baseFreq, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateHat(double sampleRate, bool open, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateCrash(double sampleRate, const InstrumentParams& params) const;
+        template <typename Primitives> Sample generateRide(double sampleRate, const InstrumentParams& params) const;
     };
 }
@@ -2,97 +2,358 @@
 
 namespace rb338
 {
+    void PatternSnapshot::compile(const PatternGrid& grid, int patternLength)
+    {
+        length = juce::jlimit(0, maxPatternSteps, patternLength);
+        events.clearQuick();
+
+        // Only tracks with trigs are visited, so a mostly empty 64-track grid compiles quickly.
+        StepMask anyTrig = 0;
+        juce::uint64 busyTracks = 0;
+        for (int track = 0; track < maxTracks; ++track)
+        {
+            const auto on = grid.getLanes(TrackId(track)).on;
+            anyTrig |= on;
+            if (on != 0)
+                busyTracks |= (juce::uint64)1 << track;
+        }
+
+        for (int step = 0; step < maxPatternSteps; ++step)
+        {
+            firstEvent[step] = events.size();
+            if ((anyTrig & StepBits::bit(step)) == 0)
+                continue;
+
+            for (auto tracks = busyTracks; tracks != 0; tracks &= tracks - 1)
+            {
+                const TrackId track(StepBits::lowest(tracks));
+                const auto& lanes = grid.getLanes(track);
+                if ((lanes.on & StepBits::bit(step)) == 0)
+                    continue;
+
+                StepEvent event;
+                event.track = track;
+                event.accent = (lanes.accent & StepBits::bit(step)) != 0;
+                event.velocity = event.accent ? 1.0f : 0.78f;
+                event.flam = (lanes.flam & StepBits::bit(step)) != 0;
+                event.microtiming = grid.getMicrotiming(track, step);
+                event.stepIndex = step;
+
+                for (int p = 0; p < (int)AutomationParam::Count; ++p)
+                {
+                    if (grid.getAutomationPoint(track, (AutomationParam)p, step, event.automation[p]))
+                        event.automationMask |= 1 << p;
+                }
+
+                events.add(event);
+            }
+        }
+
+        firstEvent[maxPatternSteps] = events.size();
+
+        tempoSteps = grid.getTempoMask() & StepBits::lengthMask(length);
+        for (StepMask active = tempoSteps; active != 0; active &= active - 1)
+        {
+            const int step = StepBits::lowest(active);
+            int next = step;
+            do
+                next = (next + 1) % length;
+            while ((tempoSteps & StepBits::bit(next)) == 0);
+
+            auto& ramp = tempoRamps[step];
+            grid.getTempoPoint(step, ramp.startBpm);
+            grid.getTempoPoint(next, ramp.endBpm);
+            ramp.lengthSteps = next > step ? next - step : next + length - step;
+        }
+    }
+
+    Sequencer::Sequencer()
+    {
+        for (int i = 0; i < maxLayers; ++i)
+        {
+            auto* initial = new PatternSnapshot();
+            initial->compile(pattern, i == 0 ? length : 0);
+            layers[i].snapshots.add(initial);
+            layers[i].published.store(initial, std::memory_order_release);
+            layers[i].playback = initial;
+        }
+
+        TransportPosition initial;
+        initial.bpm = bpm.load(std::memory_order_relaxed);
+        transport.publish(initial);
+    }
+
+    Sequencer::ScopedEdit::ScopedEdit(Sequencer& sequencer)
+        : owner(sequencer)
+    {
+        ++owner.editDepth;
+    }
+
+    Sequencer::ScopedEdit::~ScopedEdit()
+    {
+        if (--owner.editDepth == 0)
+            owner.publishPattern();
+    }
+
     void Sequencer::prepare(double newSampleRate)
     {
         sampleRate = newSampleRate;
-        samplesUntilNextStep = stepSamples();
-        driftMemoryMs = 0.0f;
+        pending.allocate(maxScheduledEvents);
+        pendingPulses.allocate(maxPendingPulses);
+        droppedEvents.store(0, std::memory_order_relaxed);
+        droppedPulses.store(0, std::memory_order_relaxed);
+        resetTransport();
+        appliedStartSerial = startRequest.load(std::memory_order_acquire);
+        clockSync.pending = false;
+
+        // Snapshots may have been freed while stopped; only the published ones are sure to exist.
+        acquirePattern();
+        playing.store(true, std::memory_order_release);
+    }
+
+    void Sequencer::release()
+    {
+        playing.store(false, std::memory_order_release);
     }
 
     void Sequencer::setBpm(float newBpm)
     {
-        const float oldBpm = bpm;
-        bpm = juce::jlimit(40.0f, 200.0f, newBpm);
+        postTempoRequest(newBpm, 0, TempoCurve::Linear);
+    }
 
-        // Keep playback continuous when changing tempo mid-run by scaling the remaining
-        // time to the next step instead of hard-resetting the transport phase.
-        if (running && oldBpm > 0.0f)
-        {
-            const double oldStepSamps = (60.0 / oldBpm) / 4.0 * sampleRate;
-            const double newStepSamps = (60.0 / bpm) / 4.0 * sampleRate;
-            if (oldStepSamps > 0.0)
-                samplesUntilNextStep = juce::jmax(1, (int)std::round(samplesUntilNextStep * (newStepSamps / oldStepSamps)));
-        }
-        else
-        {
-            samplesUntilNextStep = stepSamples();
-        }
+    void Sequencer::rampToBpm(float targetBpm, int steps, TempoCurve curve)
+    {
+        postTempoRequest(targetBpm, juce::jlimit(0, 0xffff, steps), curve);
+    }
+
+    void Sequencer::postTempoRequest(float targetBpm, int steps, TempoCurve curve)
+    {
+        const float clamped = juce::jlimit(40.0f, 200.0f, targetBpm);
+        bpm.store(clamped, std::memory_order_relaxed);
+        tempoRequestSerial = (tempoRequestSerial + 1) & 0xfff;
+
+        juce::uint32 bpmBits = 0;
+        std::memcpy(&bpmBits, &clamped, sizeof(bpmBits));
+        tempoRequest.store((juce::uint64)bpmBits
+                               | ((juce::uint64)steps << 32)
+                               | ((juce::uint64)curve << 48)
+                               | ((juce::uint64)tempoRequestSerial << 52),
+                           std::memory_order_release);
+    }
+
+    void Sequencer::applyTempoRequest()
+    {
+        const auto request = tempoRequest.load(std::memory_order_acquire);
+        const auto serial = (juce::uint32)(request >> 52);
+        if (serial == appliedTempoSerial)
+            return;
+
+        appliedTempoSerial = serial;
+
+        const auto bpmBits = (juce::uint32)(request & 0xffffffffu);
+        float target = 0.0f;
+        std::memcpy(&target, &bpmBits, sizeof(target));
+        const int steps = (int)((request >> 32) & 0xffff);
+        const auto curve = (TempoCurve)((request >> 48) & 0xf);
+
+        const double phase = (double)nextExpandStep;
+        startTempoSegment(phase, tempo.bpmAt(phase), target, steps, curve);
+    }
+
+    void Sequencer::startTempoSegment(double phase, double fromBpm, double toBpm, int steps, TempoCurve curve)
+    {
+        TempoSegment next;
+        next.startSample = tempo.timeAt(phase, sampleRate);
+        next.startPhase = phase;
+        next.startBpm = fromBpm;
+        next.endBpm = toBpm;
+        next.lengthSteps = (double)steps;
+        next.curve = curve;
+        tempo = next;
+    }
+
+    void Sequencer::setExternalSync(bool shouldSync)
+    {
+        externalSync.store(shouldSync, std::memory_order_relaxed);
+    }
+
+    bool Sequencer::isExternalSync() const
+    {
+        return externalSync.load(std::memory_order_relaxed);
+    }
+
+    void Sequencer::syncToClock(double phase, double offset, double clockBpm)
+    {
+        clockSync.pending = true;
+        clockSync.hasPosition = true;
+        clockSync.phase = phase;
+        clockSync.position = (double)samplePosition + offset;
+        clockSync.bpm = juce::jlimit(20.0, 400.0, clockBpm);
+    }
+
+    void Sequencer::followClockTempo(double clockBpm)
+    {
+        clockSync.pending = true;
+        clockSync.hasPosition = false;
+        clockSync.bpm = juce::jlimit(20.0, 400.0, clockBpm);
+    }
+
+    void Sequencer::applyClockSync()
+    {
+        if (!clockSync.pending)
+            return;
+        clockSync.pending = false;
+
+        // Re-anchor the grid on the clock from the next unexpanded step. Steps already expanded
+        // keep their times, so the new anchor may never put a step behind the last one.
+        const double phase = (double)nextExpandStep;
+        const double samplesPerStep = 60.0 / clockSync.bpm / 4.0 * sampleRate;
+        const double lastStepTime = stepTimes[(nextExpandStep - 1) & (stepTimeHistory - 1)];
+
+        const double anchor = clockSync.hasPosition ? clockSync.position + (phase - clockSync.phase) * samplesPerStep
+                                                    : tempo.timeAt(phase, sampleRate);
+
+        TempoSegment next;
+        next.startSample = juce::jmax(anchor, lastStepTime + 1.0);
+        next.startPhase = phase;
+        next.startBpm = clockSync.bpm;
+        next.endBpm = clockSync.bpm;
+        tempo = next;
     }
 
     void Sequencer::setShuffle(float amount)
     {
-        shuffle = juce::jlimit(0.0f, 1.0f, amount);
+        shuffle.store(juce::jlimit(0.0f, 1.0f, amount), std::memory_order_relaxed);
+    }
+
+    void Sequencer::setFlamSpacing(float ms)
+    {
+        flamSpacingMs.store(juce::jlimit(5.0f, 40.0f, ms), std::memory_order_relaxed);
     }
 
     float Sequencer::getBpm() const
     {
-        return bpm;
+        return bpm.load(std::memory_order_relaxed);
+    }
+
+    float Sequencer::getCurrentBpm() const
+    {
+        return (float)transport.read().bpm;
     }
 
     float Sequencer::getShuffle() const
     {
-        return shuffle;
+        return shuffle.load(std::memory_order_relaxed);
     }
 
     void Sequencer::setRunning(bool shouldRun)
     {
-        running = shouldRun;
-        if (running)
-        {
-            samplesUntilNextStep = stepSamples();
-            currentStep = 0;
-            driftMemoryMs = 0.0f;
-        }
+        if (shouldRun)
+            startRequest.fetch_add(1, std::memory_order_relaxed);
+        running.store(shouldRun, std::memory_order_release);
     }
 
-    bool Sequencer::isRunning() const
+    void Sequencer::continuePlayback()
     {
-        return running;
+        // Stopping freezes the transport where it was, pending hits included, so resuming just
+        // lets it run on.
+        running.store(true, std::memory_order_release);
     }
 
-    StepState Sequencer::getStep(Instrument instrument, int index) const
+    float Sequencer::getFlamSpacing() const
     {
-        if (index < 0 || index >= 16)
-            return StepState::Off;
-        return grid[(int)instrument][index];
+        return flamSpacingMs.load(std::memory_order_relaxed);
     }
 
-    void Sequencer::setStep(Instrument instrument, int index, StepState state)
+    bool Sequencer::isRunning() const
     {
-        if (index < 0 || index >= 16)
-            return;
-        grid[(int)instrument][index] = state;
+        return running.load(std::memory_order_relaxed);
     }
 
-    void Sequencer::cycleStep(Instrument instrument, int index)
+    StepState Sequencer::getStep(TrackId track, int index) const
     {
-        if (index < 0 || index >= 16)
-            return;
+        return pattern.getStep(track, index);
+    }
 
-        auto& state = grid[(int)instrument][index];
-        if (state == StepState::Off)
-            state = StepState::On;
-        else if (state == StepState::On)
-            state = StepState::Accent;
-        else
-            state = StepState::Off;
+    void Sequencer::setStep(TrackId track, int index, StepState state)
+    {
+        pattern.setStep(track, index, state);
+        patternChanged();
+    }
+
+    void Sequencer::cycleStep(TrackId track, int index)
+    {
+        pattern.cycleStep(track, index);
+        patternChanged();
     }
 
     void Sequencer::clear()
     {
-        for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-            for (int i = 0; i < 16; ++i)
-                grid[inst][i] = StepState::Off;
+        pattern.clear();
+        patternChanged();
+    }
+
+    void Sequencer::clearTrack(TrackId track)
+    {
+        pattern.clearTrack(track);
+        patternChanged();
+    }
+
+    bool Sequencer::getFlam(TrackId track, int index) const
+    {
+        return pattern.getFlam(track, index);
+    }
+
+    void Sequencer::setFlam(TrackId track, int index, bool shouldFlam)
+    {
+        pattern.setFlam(track, index, shouldFlam);
+        patternChanged();
+    }
+
+    float Sequencer::getMicrotiming(TrackId track, int index) const
+    {
+        return pattern.getMicrotiming(track, index);
+    }
+
+    void Sequencer::setMicrotiming(TrackId track, int index, float offset)
+    {
+        pattern.setMicrotiming(track, index, offset);
+        patternChanged();
+    }
+
+    const PatternGrid& Sequencer::getPattern() const
+    {
+        return pattern;
+    }
+
+    void Sequencer::setPattern(const PatternGrid& newPattern)
+    {
+        pattern = newPattern;
+        patternChanged();
+    }
+
+    void Sequencer::rotateTrack(TrackId track, int amount)
+    {
+        pattern.rotateTrack(track, length, amount);
+        patternChanged();
+    }
+
+    void Sequencer::shiftTrack(TrackId track, int amount)
+    {
+        pattern.shiftTrack(track, length, amount);
+        patternChanged();
+    }
+
+    void Sequencer::invertTrack(TrackId track)
+    {
+        pattern.invertTrack(track, length);
+        patternChanged();
+    }
+
+    void Sequencer::mirrorTrack(TrackId track)
+    {
+        pattern.mirrorTrack(track, length);
+        patternChanged();
     }
 
     void Sequencer::setLength(int steps)
@@ -108,138 +369,463 @@ namespace rb338
 
     int Sequencer::getCurrentStep() const
     {
-        return currentStep;
+        return transport.read().step;
     }
 
-    void Sequencer::setAutomationPoint(Instrument instrument, AutomationParam param, int step, float value)
+    double Sequencer::getTransportPhase() const
     {
-        if (step < 0 || step >= 16)
-            return;
+        // Interpolate between the steps either side of the current sample. The next one may not
+        // be expanded yet, in which case the current tempo segment still covers it.
+        const auto last = nextStepNumber - 1;
+        const double from = stepTimes[last & (stepTimeHistory - 1)];
+        const double to = nextStepNumber < nextExpandStep ? stepTimes[nextStepNumber & (stepTimeHistory - 1)]
+                                                          : tempo.timeAt((double)nextStepNumber, sampleRate);
+        if (to <= from)
+            return (double)last;
+        return (double)last + ((double)samplePosition - from) / (to - from);
+    }
 
-        auto instIndex = (int)instrument;
-        auto paramIndex = (int)param;
-        if (instIndex < 0 || instIndex >= (int)Instrument::Count
-            || paramIndex < 0 || paramIndex >= (int)AutomationParam::Count)
+    TransportPosition Sequencer::getTransportPosition() const
+    {
+        return transport.read();
+    }
+
+    void Sequencer::setOutputLatency(int samples)
+    {
+        outputLatency.store(juce::jmax(0, samples), std::memory_order_relaxed);
+    }
+
+    double Sequencer::getPhaseAtOffset(double offset) const
+    {
+        // Walk back through the expanded steps still in the history to the one at or before
+        // the position. Anything older is extrapolated from the oldest step we still know.
+        const double position = (double)samplePosition + offset;
+        const auto oldest = juce::jmax((juce::int64)-1, nextExpandStep - stepTimeHistory);
+        auto step = nextExpandStep - 1;
+        while (step > oldest && stepTimes[step & (stepTimeHistory - 1)] > position)
+            --step;
+
+        const double from = stepTimes[step & (stepTimeHistory - 1)];
+        const auto next = step + 1;
+        const double to = next < nextExpandStep ? stepTimes[next & (stepTimeHistory - 1)]
+                                                : tempo.timeAt((double)next, sampleRate);
+        if (to <= from)
+            return (double)step;
+        return (double)step + (position - from) / (to - from);
+    }
+
+    void Sequencer::setAutomationPoint(TrackId track, AutomationParam param, int step, float value)
+    {
+        pattern.setAutomationPoint(track, param, step, value);
+        patternChanged();
+    }
+
+    bool Sequencer::getAutomationPoint(TrackId track, AutomationParam param, int step, float& valueOut) const
+    {
+        return pattern.getAutomationPoint(track, param, step, valueOut);
+    }
+
+    bool Sequencer::hasAutomation(TrackId track) const
+    {
+        return pattern.hasAutomation(track);
+    }
+
+    void Sequencer::clearAutomation(TrackId track)
+    {
+        pattern.clearAutomation(track);
+        patternChanged();
+    }
+
+    void Sequencer::clearAllAutomation()
+    {
+        pattern.clearAllAutomation();
+        patternChanged();
+    }
+
+    void Sequencer::patternChanged()
+    {
+        if (editDepth == 0)
+            publishPattern();
+    }
+
+    void Sequencer::publishPattern()
+    {
+        publishLayer(0, pattern, length);
+    }
+
+    void Sequencer::publishLayer(int layer, const PatternGrid& layerPattern, int layerLength)
+    {
+        auto& slot = layers[layer];
+        reclaimSnapshots(slot);
+
+        auto* snapshot = new PatternSnapshot();
+        snapshot->version = nextVersion++;
+        snapshot->compile(layerPattern, layerLength);
+        slot.snapshots.add(snapshot);
+        slot.published.store(snapshot, std::memory_order_release);
+    }
+
+    void Sequencer::reclaimSnapshots(Layer& layer)
+    {
+        // The audio thread never goes back to an older version once it has acknowledged a
+        // newer one, so anything below the acknowledgement is unreachable. With no audio thread
+        // running, only the published snapshot is, as prepare starts from it.
+        const auto* current = layer.published.load(std::memory_order_relaxed);
+        const auto acknowledged = playing.load(std::memory_order_acquire) ? layer.acknowledgedVersion.load(std::memory_order_acquire)
+                                                                          : current->version;
+
+        for (int i = layer.snapshots.size() - 1; i >= 0; --i)
+        {
+            auto* snapshot = layer.snapshots[i];
+            if (snapshot != current && snapshot->version < acknowledged)
+                layer.snapshots.remove(i);
+        }
+    }
+
+    void Sequencer::setLayerPattern(int layer, const PatternGrid& layerPattern, int layerLength)
+    {
+        if (layer <= 0 || layer >= maxLayers)
             return;
+        publishLayer(layer, layerPattern, juce::jlimit(1, maxPatternSteps, layerLength));
+    }
 
-        automationActive[instIndex][paramIndex][step] = true;
-        automationValue[instIndex][paramIndex][step] = juce::jlimit(0.0f, 1.0f, value);
+    void Sequencer::clearLayer(int layer)
+    {
+        if (layer <= 0 || layer >= maxLayers)
+            return;
+        publishLayer(layer, {}, 0);
+        layers[layer].muted.store(false, std::memory_order_relaxed);
     }
 
-    bool Sequencer::getAutomationPoint(Instrument instrument, AutomationParam param, int step, float& valueOut) const
+    bool Sequencer::isLayerActive(int layer) const
     {
-        if (step < 0 || step >= 16)
+        if (layer < 0 || layer >= maxLayers)
             return false;
+        return layers[layer].published.load(std::memory_order_relaxed)->length > 0;
+    }
 
-        auto instIndex = (int)instrument;
-        auto paramIndex = (int)param;
-        if (instIndex < 0 || instIndex >= (int)Instrument::Count
-            || paramIndex < 0 || paramIndex >= (int)AutomationParam::Count)
-            return false;
+    void Sequencer::setLayerMuted(int layer, bool shouldMute)
+    {
+        if (layer >= 0 && layer < maxLayers)
+            layers[layer].muted.store(shouldMute, std::memory_order_relaxed);
+    }
 
-        if (!automationActive[instIndex][paramIndex][step])
+    bool Sequencer::isLayerMuted(int layer) const
+    {
+        if (layer < 0 || layer >= maxLayers)
             return false;
+        return layers[layer].muted.load(std::memory_order_relaxed);
+    }
 
-        valueOut = automationValue[instIndex][paramIndex][step];
-        return true;
+    void Sequencer::setTempoPoint(int step, float newBpm)
+    {
+        pattern.setTempoPoint(step, newBpm);
+        patternChanged();
     }
 
-    bool Sequencer::hasAutomation(Instrument instrument) const
+    void Sequencer::clearTempoAutomation()
     {
-        auto instIndex = (int)instrument;
-        if (instIndex < 0 || instIndex >= (int)Instrument::Count)
-            return false;
+        pattern.clearTempoAutomation();
+        patternChanged();
+    }
 
-        for (int param = 0; param < (int)AutomationParam::Count; ++param)
-            for (int step = 0; step < 16; ++step)
-                if (automationActive[instIndex][param][step])
-                    return true;
+    bool Sequencer::hasTempoAutomation() const
+    {
+        return pattern.getTempoMask() != 0;
+    }
 
-        return false;
+    void Sequencer::acquirePattern()
+    {
+        for (auto& layer : layers)
+        {
+            layer.playback = layer.published.load(std::memory_order_acquire);
+            layer.acknowledgedVersion.store(layer.playback->version, std::memory_order_release);
+        }
     }
 
-    void Sequencer::clearAutomation(Instrument instrument)
+    void Sequencer::renderBlock(int numSamples, juce::Array<ScheduledEvent>& events, juce::Array<ClockMessage>& clock)
     {
-        auto instIndex = (int)instrument;
-        if (instIndex < 0 || instIndex >= (int)Instrument::Count)
+        events.clearQuick();
+        clock.clearQuick();
+
+        // A restart that happened between two blocks still needs its Start.
+        const bool isRunningNow = running.load(std::memory_order_acquire);
+        const auto startSerial = startRequest.load(std::memory_order_relaxed);
+        const bool fromTop = isRunningNow && startSerial != appliedStartSerial;
+        if (fromTop)
+        {
+            appliedStartSerial = startSerial;
+            resetTransport();
+        }
+        if (isRunningNow != clockRunning || (isRunningNow && fromTop))
+        {
+            clockRunning = isRunningNow;
+            ClockMessage message;
+            message.type = !isRunningNow ? ClockMessage::Type::Stop
+                                         : (fromTop ? ClockMessage::Type::Start : ClockMessage::Type::Continue);
+            clock.add(message);
+        }
+
+        if (!isRunningNow)
+        {
+            clockSync.pending = false;
+            publishTransport();
             return;
+        }
 
-        for (int param = 0; param < (int)AutomationParam::Count; ++param)
-            for (int step = 0; step < 16; ++step)
-            {
-                automationActive[instIndex][param][step] = false;
-                automationValue[instIndex][param][step] = 0.0f;
-            }
+        if (externalSync.load(std::memory_order_relaxed))
+            applyClockSync();
+        else
+            applyTempoRequest();
+
+        const juce::int64 blockStart = samplePosition;
+        const juce::int64 blockEnd = samplePosition + numSamples;
+        samplePosition = blockEnd;
+
+        // Far enough ahead to cover a half-step early nudge, the flam grace hit and clock drift.
+        const double flamMs = flamSpacingMs.load(std::memory_order_relaxed);
+        const double lookahead = stepLengthAt((double)nextExpandStep) * 0.5 + (flamMs + 1.0) * 0.001 * sampleRate + 1.0;
+        while (getStepTime(nextExpandStep) - lookahead < (double)blockEnd)
+            expandStep(nextExpandStep++);
+
+        while (nextStepNumber < nextExpandStep && stepTimes[nextStepNumber & (stepTimeHistory - 1)] < (double)blockEnd)
+            ++nextStepNumber;
+
+        // Both queues are in time order, so the block's share is at the front and comes out sorted.
+        while (!pending.isEmpty() && pending[0].samplePosition < blockEnd)
+        {
+            auto scheduled = pending[0];
+            pending.removeFirst();
+            scheduled.offset = (int)juce::jmax((juce::int64)0, scheduled.samplePosition - blockStart);
+            events.add(scheduled);
+        }
+
+        while (!pendingPulses.isEmpty() && pendingPulses[0] < blockEnd)
+        {
+            ClockMessage message;
+            message.offset = (int)juce::jmax((juce::int64)0, pendingPulses[0] - blockStart);
+            clock.add(message);
+            pendingPulses.removeFirst();
+        }
+
+        publishTransport();
     }
 
-    void Sequencer::clearAllAutomation()
+    void Sequencer::setAutomationLookahead(int steps)
     {
-        for (int inst = 0; inst < (int)Instrument::Count; ++inst)
-            clearAutomation((Instrument)inst);
+        automationLookahead.store(juce::jlimit(1, maxPatternSteps, steps), std::memory_order_relaxed);
     }
 
-    bool Sequencer::nextSample(juce::Array<StepEvent>& events)
+    int Sequencer::getAutomationLookahead() const
     {
-        events.clear();
+        return automationLookahead.load(std::memory_order_relaxed);
+    }
 
-        if (!running)
-            return false;
+    int Sequencer::collectUpcomingAutomation(juce::Array<StepEvent>& upcoming) const
+    {
+        if (!clockRunning)
+            return 0;
 
-        samplesUntilNextStep--;
-        if (samplesUntilNextStep > 0)
-            return false;
+        int skipped = 0;
+        const auto add = [&upcoming, &skipped](const StepEvent& event)
+        {
+            if (upcoming.size() < maxUpcomingAutomation)
+                upcoming.add(event);
+            else
+                ++skipped;
+        };
+
+        for (int i = 0; i < pending.size(); ++i)
+            if (pending[i].event.automationMask != 0)
+                add(pending[i].event);
+
+        const juce::int64 end = nextStepNumber + automationLookahead.load(std::memory_order_relaxed);
+        for (auto stepNumber = nextExpandStep; stepNumber < end; ++stepNumber)
+        {
+            for (const auto& layer : layers)
+            {
+                const auto* snapshot = layer.playback;
+                if (snapshot->length == 0 || layer.muted.load(std::memory_order_relaxed))
+                    continue;
+
+                const int layerStep = (int)(stepNumber % snapshot->length);
+                for (int i = snapshot->firstEvent[layerStep]; i < snapshot->firstEvent[layerStep + 1]; ++i)
+                {
+                    const auto& event = snapshot->events.getReference(i);
+                    if (event.automationMask != 0)
+                        add(event);
+                }
+            }
+        }
+
+        return skipped;
+    }
+
+    void Sequencer::expandStep(juce::int64 stepNumber)
+    {
+        const int step = (int)(stepNumber % length);
+        const double phase = (double)stepNumber;
 
-        const int baseStep = stepSamples();
-        const int shuffleDelay = getStepDelay(currentStep);
-        const int analogDrift = getAnalogStepDrift(currentStep);
-        samplesUntilNextStep = juce::jmax(1, baseStep + shuffleDelay + analogDrift);
+        // Tempo automation takes over at its step and ramps towards the next point. Only the
+        // main pattern drives the tempo.
+        const auto* main = layers[0].playback;
+        if ((main->tempoSteps & StepBits::bit(step)) != 0 && !externalSync.load(std::memory_order_relaxed))
+        {
+            const auto& ramp = main->tempoRamps[step];
+            startTempoSegment(phase, ramp.startBpm, ramp.endBpm, ramp.lengthSteps, TempoCurve::Linear);
+        }
 
-        for (int inst = 0; inst < (int)Instrument::Count; ++inst)
+        // Shuffle and drift are offsets from the ideal grid position of this step, never
+        // added to the interval, so they cannot accumulate into the transport.
+        const double stepLength = stepLengthAt(phase);
+        const double idealTime = tempo.timeAt(phase, sampleRate);
+        const double stepTime = idealTime + getStepDelay(step, stepLength) + getAnalogStepDrift(step);
+        stepTimes[stepNumber & (stepTimeHistory - 1)] = idealTime;
+
+        // Clock pulses follow the ideal grid; shuffle and drift are ours, not the receiver's.
+        for (int pulse = 0; pulse < clockPulsesPerStep; ++pulse)
         {
-            auto state = grid[inst][currentStep];
-            if (state != StepState::Off)
+            if (pendingPulses.isFull())
             {
-                StepEvent event;
-                event.instrument = (Instrument)inst;
-                event.velocity = (state == StepState::Accent) ? 1.0f : 0.78f;
-                event.flam = false;
-                event.stepIndex = currentStep;
-                events.add(event);
+                droppedPulses.fetch_add(1, std::memory_order_relaxed);
+                continue;
             }
+            pendingPulses.add((juce::int64)std::ceil(tempo.timeAt(phase + (double)pulse / clockPulsesPerStep, sampleRate)));
+        }
+
+        for (const auto& layer : layers)
+        {
+            const auto* snapshot = layer.playback;
+            if (snapshot->length == 0 || layer.muted.load(std::memory_order_relaxed))
+                continue;
+
+            const int layerStep = (int)(stepNumber % snapshot->length);
+            for (int i = snapshot->firstEvent[layerStep]; i < snapshot->firstEvent[layerStep + 1]; ++i)
+                scheduleTrig(snapshot->events.getReference(i), stepTime, stepLength);
+        }
+    }
+
+    void Sequencer::scheduleTrig(const StepEvent& trig, double stepTime, double stepLength)
+    {
+        ScheduledEvent scheduled;
+        scheduled.event = trig;
+        const double hitTime = stepTime + trig.microtiming * stepLength;
+
+        if (trig.flam)
+        {
+            // The grace hit goes first, softer and unaccented, and takes the step's
+            // automation with it so both hits share the same sound.
+            ScheduledEvent grace = scheduled;
+            grace.event.velocity *= 0.6f;
+            grace.event.accent = false;
+            grace.samplePosition = (juce::int64)std::ceil(hitTime - flamSpacingMs.load(std::memory_order_relaxed) * 0.001 * sampleRate);
+            addPending(grace);
+
+            scheduled.event.flam = false;
+            scheduled.event.automationMask = 0;
+        }
+
+        scheduled.samplePosition = (juce::int64)std::ceil(hitTime);
+        addPending(scheduled);
+    }
+
+    void Sequencer::addPending(const ScheduledEvent& scheduled)
+    {
+        if (pending.isFull())
+        {
+            droppedEvents.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
 
-        currentStep = (currentStep + 1) % length;
-        return !events.isEmpty();
+        // Steps are expanded in order, so a hit only ever moves back past the few later ones that
+        // nudges, shuffle and flams put around it. Equal times keep the order they were added in.
+        pending.add(scheduled);
+        for (int i = pending.size() - 1; i > 0 && pending[i - 1].samplePosition > scheduled.samplePosition; --i)
+            std::swap(pending[i - 1], pending[i]);
+    }
+
+    int Sequencer::getDroppedEvents() const
+    {
+        return droppedEvents.load(std::memory_order_relaxed);
+    }
+
+    int Sequencer::getDroppedClockPulses() const
+    {
+        return droppedPulses.load(std::memory_order_relaxed);
     }
 
-    int Sequencer::stepSamples() const
+    double Sequencer::stepLengthAt(double phase) const
     {
-        double secondsPerBeat = 60.0 / bpm;
+        double secondsPerBeat = 60.0 / tempo.bpmAt(phase);
         double secondsPerStep = secondsPerBeat / 4.0;
-        return (int)std::round(secondsPerStep * sampleRate);
+        return secondsPerStep * sampleRate;
     }
 
-    int Sequencer::getStepDelay(int step) const
+    void Sequencer::resetTransport()
     {
-        // Shuffle affects even-numbered steps (1, 3, 5, 7, etc. in 0-based indexing)
-        // by delaying them slightly
-        if (shuffle == 0.0f || step % 2 == 0)
-            return 0;
+        driftMemoryMs = 0.0f;
+        samplePosition = 0;
+        nextStepNumber = 0;
+        nextExpandStep = 0;
+        pending.clear();
+        pendingPulses.clear();
+
+        // The first step sounds one step after start, as it always has.
+        tempo = {};
+        tempo.startPhase = -1.0;
+        tempo.startBpm = bpm.load(std::memory_order_relaxed);
+        tempo.endBpm = tempo.startBpm;
+        appliedTempoSerial = (juce::uint32)(tempoRequest.load(std::memory_order_acquire) >> 52);
+
+        stepTimes[(juce::int64)-1 & (stepTimeHistory - 1)] = tempo.startSample;
+    }
+
+    void Sequencer::publishTransport()
+    {
+        TransportPosition position;
+        position.running = clockRunning;
+        position.externalSync = externalSync.load(std::memory_order_relaxed);
+        position.sampleRate = sampleRate;
+        position.samplePosition = samplePosition;
+        position.phase = getTransportPhase();
+        position.step = nextStepNumber > 0 ? (int)((nextStepNumber - 1) % length) : 0;
+
+        const auto wholeSteps = juce::jmax((juce::int64)0, (juce::int64)std::floor(position.phase));
+        position.bar = (int)(wholeSteps / 16);
+        position.beat = (int)(wholeSteps % 16) / 4;
+        position.bpm = position.running ? tempo.bpmAt(position.phase) : (double)bpm.load(std::memory_order_relaxed);
+        position.outputLatency = outputLatency.load(std::memory_order_relaxed);
+        position.publishedMs = juce::Time::getMillisecondCounterHiRes();
+        transport.publish(position);
+    }
+
+    double Sequencer::getStepTime(juce::int64 stepNumber) const
+    {
+        const int step = (int)(stepNumber % length);
+        const double phase = (double)stepNumber;
+        return tempo.timeAt(phase, sampleRate) + getStepDelay(step, stepLengthAt(phase));
+    }
+
+    double Sequencer::getStepDelay(int step, double stepLength) const
+    {
+        // Shuffle delays the off-beat steps (1, 3, 5, 7, etc. in 0-based indexing)
+        const float amount = shuffle.load(std::memory_order_relaxed);
+        if (amount == 0.0f || step % 2 == 0)
+            return 0.0;
 
         // Maximum shuffle delay is 33% of step length (triplet feel at max)
-        int baseStep = stepSamples();
-        return (int)(baseStep * shuffle * 0.33f);
+        return stepLength * amount * 0.33;
     }
 
-    int Sequencer::getAnalogStepDrift(int step)
+    double Sequencer::getAnalogStepDrift(int step)
     {
         // Subtle analog-style clock wander: tiny and structured, only every 4th step.
         if (step % 4 != 0)
-            return 0;
+            return 0.0;
 
         const float targetMs = (timingRng.nextFloat() * 2.0f - 1.0f) * 1.0f; // +/- 1 ms max
         driftMemoryMs = driftMemoryMs * 0.65f + targetMs * 0.35f;
         const float clampedMs = juce::jlimit(-1.0f, 1.0f, driftMemoryMs);
-        return (int)std::round(clampedMs * 0.001f * (float)sampleRate);
+        return clampedMs * 0.001 * sampleRate;
     }
 }
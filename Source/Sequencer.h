@@ -1,81 +1,328 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "Samples.h"
+#include "Pattern.h"
+#include "Tempo.h"
+#include "Transport.h"
 
 namespace rb338
 {
-    enum class AutomationParam
+    struct StepEvent
     {
-        Level = 0,
-        Tune,
-        Decay,
-        Tone,
-        Snappy,
-        Count
+        TrackId track;
+        float velocity = 1.0f;
+        bool accent = false;
+        bool flam = false; // compiled trig: carries a grace hit; scheduled event: is the grace hit
+        float microtiming = 0.0f; // fraction of a step, -0.5..0.5
+        int stepIndex = 0;
+        int automationMask = 0; // one bit per AutomationParam recorded on this trig
+        float automation[(int)AutomationParam::Count] = {};
     };
 
-    enum class StepState
+    // Immutable once published. The audio thread only ever sees patterns through one of these.
+    // Trigs are compiled into a flat list sorted by step, so playback touches active hits only,
+    // and a snapshot holds no more than the pattern's trigs and tempo points; the grid they
+    // came from stays with the editor.
+    struct PatternSnapshot
     {
-        Off = 0,
-        On = 1,
-        Accent = 2
+        juce::uint64 version = 0;
+        int length = 0; // 0 = nothing to play
+        juce::Array<StepEvent> events;
+        int firstEvent[maxPatternSteps + 1] = {}; // events for step s are [firstEvent[s], firstEvent[s + 1])
+
+        // Tempo automation resolved into one ramp per point, running to the next point.
+        struct TempoRamp
+        {
+            float startBpm = 0.0f;
+            float endBpm = 0.0f;
+            int lengthSteps = 0;
+        };
+
+        StepMask tempoSteps = 0;
+        TempoRamp tempoRamps[maxPatternSteps];
+
+        void compile(const PatternGrid& grid, int length);
     };
 
-    struct StepEvent
+    // An event placed on the transport timeline. offset is relative to the block it falls in.
+    struct ScheduledEvent
     {
-        Instrument instrument;
-        float velocity = 1.0f;
-        bool flam = false;
-        int stepIndex = 0;
+        StepEvent event;
+        juce::int64 samplePosition = 0;
+        int offset = 0;
+    };
+
+    // MIDI clock and transport messages produced by the sequencer, placed like ScheduledEvent.
+    struct ClockMessage
+    {
+        enum class Type
+        {
+            Pulse = 0,
+            Start,
+            Continue,
+            Stop
+        };
+
+        Type type = Type::Pulse;
+        int offset = 0;
     };
 
     class Sequencer
     {
     public:
+        Sequencer();
+
+        // Groups several pattern edits (drag painting, pattern loads) into a single publish.
+        class ScopedEdit
+        {
+        public:
+            explicit ScopedEdit(Sequencer& sequencer);
+            ~ScopedEdit();
+
+        private:
+            Sequencer& owner;
+            JUCE_DECLARE_NON_COPYABLE(ScopedEdit)
+        };
+
         void prepare(double sampleRate);
+        void release(); // after the audio thread's last block, until the next prepare
         void setBpm(float bpm);
+        void rampToBpm(float targetBpm, int steps, TempoCurve curve); // takes effect from the next step
         void setShuffle(float amount); // 0.0 = no shuffle, 1.0 = max shuffle
-        float getBpm() const;
+        void setFlamSpacing(float ms);
+        float getBpm() const; // last requested tempo
+        float getCurrentBpm() const; // tempo of the last rendered block, including ramps and external clock
         float getShuffle() const;
-        void setRunning(bool shouldRun);
+        float getFlamSpacing() const;
+        void setRunning(bool shouldRun); // starting always rewinds to the first step
+        void continuePlayback(); // starts again from where the transport stopped
         bool isRunning() const;
 
-        StepState getStep(Instrument instrument, int index) const;
-        void setStep(Instrument instrument, int index, StepState state);
-        void cycleStep(Instrument instrument, int index);
+        StepState getStep(TrackId track, int index) const;
+        void setStep(TrackId track, int index, StepState state);
+        void cycleStep(TrackId track, int index);
         void clear();
+        void clearTrack(TrackId track);
+
+        bool getFlam(TrackId track, int index) const;
+        void setFlam(TrackId track, int index, bool shouldFlam);
+        float getMicrotiming(TrackId track, int index) const;
+        void setMicrotiming(TrackId track, int index, float offset);
+
+        const PatternGrid& getPattern() const;
+        void setPattern(const PatternGrid& newPattern);
+
+        // Row edits on the current pattern length.
+        void rotateTrack(TrackId track, int amount);
+        void shiftTrack(TrackId track, int amount);
+        void invertTrack(TrackId track);
+        void mirrorTrack(TrackId track);
 
         void setLength(int steps);
         int getLength() const;
 
-        int getCurrentStep() const;
+        int getCurrentStep() const; // pattern step that sounded last
+        double getTransportPhase() const; // audio thread: steps elapsed since start, on the ideal (unshuffled) grid
+        double getPhaseAtOffset(double offset) const; // audio thread: phase `offset` samples from the next block's start
 
-        void setAutomationPoint(Instrument instrument, AutomationParam param, int step, float value);
-        bool getAutomationPoint(Instrument instrument, AutomationParam param, int step, float& valueOut) const;
-        bool hasAutomation(Instrument instrument) const;
-        void clearAutomation(Instrument instrument);
+        void setAutomationPoint(TrackId track, AutomationParam param, int step, float value);
+        bool getAutomationPoint(TrackId track, AutomationParam param, int step, float& valueOut) const;
+        bool hasAutomation(TrackId track) const;
+        void clearAutomation(TrackId track);
         void clearAllAutomation();
 
-        bool nextSample(juce::Array<StepEvent>& events);
+        void setTempoPoint(int step, float bpm);
+        void clearTempoAutomation();
+        bool hasTempoAutomation() const;
+
+        // Extra patterns that play on top of the main one, sharing its transport and voices.
+        // Layer 0 is the main pattern edited through the calls above. A new layer pattern
+        // takes over at the next step, so switching is gapless.
+        static constexpr int maxLayers = 4;
+        void setLayerPattern(int layer, const PatternGrid& layerPattern, int layerLength);
+        void clearLayer(int layer);
+        bool isLayerActive(int layer) const;
+        void setLayerMuted(int layer, bool shouldMute);
+        bool isLayerMuted(int layer) const;
+
+        // Audio thread: pick up the latest published patterns. Call once per block before renderBlock.
+        void acquirePattern();
+
+        // External clock. While enabled, the internal tempo and tempo automation are ignored and
+        // the grid follows whatever syncToClock reports.
+        static constexpr int clockPulsesPerStep = 6; // 24 per quarter note, steps are sixteenths
+        void setExternalSync(bool shouldSync);
+        bool isExternalSync() const;
+
+        // Audio thread, before renderBlock: step `phase` falls `offset` samples after the start of
+        // the coming block and the tempo is clockBpm. Applies from the next unexpanded step.
+        // followClockTempo takes the tempo only, for when the clock's position is not known.
+        void syncToClock(double phase, double offset, double clockBpm);
+        void followClockTempo(double clockBpm);
+
+        // Any thread: the transport as of the last rendered block, published without locks.
+        TransportPosition getTransportPosition() const;
+        void setOutputLatency(int samples); // reported with the position so readers can line up with what is heard
+
+        // Audio thread: advances the transport by numSamples and fills `events` with everything
+        // that lands inside the block, sorted by offset. `clock` gets the block's MIDI clock
+        // pulses and transport changes in the same way.
+        void renderBlock(int numSamples, juce::Array<ScheduledEvent>& events, juce::Array<ClockMessage>& clock);
+
+        // Hits waiting to play are kept in storage allocated by prepare: room for four steps with
+        // every track of every layer flammed. Hits beyond that are dropped rather than allocated
+        // for on the audio thread, and counted.
+        static constexpr int maxScheduledEvents = maxTracks * maxLayers * 2 * 4;
+        int getDroppedEvents() const; // since prepare
+
+        // Clock pulses waiting to be sent are kept the same way, with room for every step the
+        // transport remembers. Pulses beyond that are dropped and counted.
+        int getDroppedClockPulses() const; // since prepare
+
+        // Audio thread, after renderBlock: appends the automated trigs still to come within the
+        // lookahead, in playing order, starting with those already expanded past this block. Work
+        // a trig's automation needs can then be started before the trig plays.
+        // `upcoming` is kept to maxUpcomingAutomation, enough for a block's hits, the ones expanded
+        // past it and four steps with every track of every layer automated. Trigs past that are
+        // left out and counted; the return value is how many.
+        static constexpr int maxUpcomingAutomation = maxScheduledEvents * 2 + maxTracks * maxLayers * 4;
+        void setAutomationLookahead(int steps);
+        int getAutomationLookahead() const;
+        int collectUpcomingAutomation(juce::Array<StepEvent>& upcoming) const;
 
     private:
         double sampleRate = 44100.0;
-        float bpm = 125.0f;
-        float shuffle = 0.0f; // 0-1 range
-        bool running = false;
+        std::atomic<float> bpm { 125.0f };
+        std::atomic<float> shuffle { 0.0f }; // 0-1 range
+        std::atomic<float> flamSpacingMs { 20.0f };
+        std::atomic<bool> running { false }; // as requested; the audio thread follows at its next block
         int length = 16;
-        int currentStep = 0;
-        int samplesUntilNextStep = 0;
         float driftMemoryMs = 0.0f;
         juce::Random timingRng { 9099 };
 
-        StepState grid[(int)Instrument::Count][16] = {};
-        bool automationActive[(int)Instrument::Count][(int)AutomationParam::Count][16] = {};
-        float automationValue[(int)Instrument::Count][(int)AutomationParam::Count][16] = {};
+        // Transport clock. Step n sits at phase n, and its sample position comes from the current
+        // tempo segment rather than being accumulated, so rounding never builds up. Tempo changes
+        // start a new segment at the next unexpanded step, which keeps playback continuous.
+        // Steps are expanded into `pending` a little ahead of time so trigs nudged early and flam
+        // grace hits can land before their step boundary, even across blocks.
+        static constexpr int stepTimeHistory = 32;
+        static constexpr int maxPendingPulses = stepTimeHistory * clockPulsesPerStep;
+        juce::int64 samplePosition = 0;
+        juce::int64 nextStepNumber = 0;
+        juce::int64 nextExpandStep = 0;
+        TempoSegment tempo;
+        double stepTimes[stepTimeHistory] = {}; // unshuffled positions of recently expanded steps
+        // First in, first out over storage allocated by prepare. Nothing is inserted or removed
+        // in the middle, so queueing and playing cost the same however much is waiting.
+        template <typename Item>
+        struct Queue
+        {
+            void allocate(int capacity)
+            {
+                items.resize(capacity);
+                clear();
+            }
+
+            void clear()
+            {
+                first = 0;
+                count = 0;
+            }
+
+            int size() const { return count; }
+            bool isEmpty() const { return count == 0; }
+            bool isFull() const { return count == items.size(); }
+
+            Item& operator[](int i) { return items.getReference((first + i) % items.size()); }
+            const Item& operator[](int i) const { return items.getReference((first + i) % items.size()); }
+
+            void add(const Item& item)
+            {
+                ++count;
+                (*this)[count - 1] = item;
+            }
+
+            void removeFirst()
+            {
+                first = (first + 1) % items.size();
+                --count;
+            }
+
+            juce::Array<Item> items;
+            int first = 0;
+            int count = 0;
+        };
+
+        Queue<ScheduledEvent> pending; // in playing order
+        Queue<juce::int64> pendingPulses;
+        std::atomic<int> droppedEvents { 0 };
+        std::atomic<int> droppedPulses { 0 };
+
+        TransportState transport;
+        std::atomic<int> outputLatency { 0 };
+        std::atomic<int> automationLookahead { 4 };
+
+        // Transport state as last reported in the clock output. Every start from the top bumps
+        // the request serial; the audio thread rewinds when it sees a new one, so the transport
+        // is only ever reset on the thread that plays it. A start without a new serial resumes.
+        bool clockRunning = false;
+        std::atomic<juce::uint32> startRequest { 0 };
+        juce::uint32 appliedStartSerial = 0;
+
+        struct ClockSync
+        {
+            bool pending = false;
+            bool hasPosition = false;
+            double phase = 0.0;
+            double position = 0.0;
+            double bpm = 120.0;
+        };
+
+        std::atomic<bool> externalSync { false };
+        ClockSync clockSync;
+
+        // Tempo requests from the message thread, packed into one word so the audio thread
+        // never sees half of one. Applied at the start of the next block.
+        std::atomic<juce::uint64> tempoRequest { 0 };
+        juce::uint32 tempoRequestSerial = 0;
+        juce::uint32 appliedTempoSerial = 0;
+
+        // Pattern edits happen on a message-thread working copy. Each change is published as a new
+        // snapshot; the audio thread acknowledges the version it holds, and snapshots older than
+        // that acknowledgement are freed on the next publish. While no audio callback runs, nothing
+        // holds a snapshot, so every one but the published one is freed. Every layer has its own slot.
+        struct Layer
+        {
+            juce::OwnedArray<PatternSnapshot> snapshots;
+            std::atomic<PatternSnapshot*> published { nullptr };
+            std::atomic<juce::uint64> acknowledgedVersion { 0 };
+            std::atomic<bool> muted { false };
+            const PatternSnapshot* playback = nullptr;
+        };
+
+        PatternGrid pattern;
+        std::atomic<bool> playing { false }; // between prepare and release
+        int editDepth = 0;
+        juce::uint64 nextVersion = 1;
+        Layer layers[maxLayers];
+
+        void patternChanged();
+        void publishPattern();
+        void publishLayer(int layer, const PatternGrid& layerPattern, int layerLength);
+        void reclaimSnapshots(Layer& layer);
 
-        int stepSamples() const;
-        int getStepDelay(int step) const; // Returns shuffle delay for given step
-        int getAnalogStepDrift(int step);
+        void postTempoRequest(float targetBpm, int steps, TempoCurve curve);
+        void applyTempoRequest();
+        void startTempoSegment(double phase, double fromBpm, double toBpm, int steps, TempoCurve curve);
+        void applyClockSync();
+        double stepLengthAt(double phase) const;
+        void resetTransport();
+        void publishTransport();
+        double getStepTime(juce::int64 stepNumber) const;
+        void expandStep(juce::int64 stepNumber);
+        void scheduleTrig(const StepEvent& trig, double stepTime, double stepLength);
+        void addPending(const ScheduledEvent& scheduled);
+        double getStepDelay(int step, double stepLength) const; // Returns shuffle delay for given step
+        double getAnalogStepDrift(int step);
     };
 }
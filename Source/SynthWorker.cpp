@@ -0,0 +1,175 @@
+#include "SynthWorker.h"
+
+namespace rb338
+{
+    static bool sameParams(const InstrumentParams& a, const InstrumentParams& b)
+    {
+        return a.tune == b.tune && a.decay == b.decay && a.tone == b.tone && a.snappy == b.snappy;
+    }
+
+    SynthWorker::SynthWorker(const SampleLibrary& library)
+        : juce::Thread("Synth worker"), sampleLibrary(library)
+    {
+    }
+
+    SynthWorker::~SynthWorker()
+    {
+        stopThread(2000);
+    }
+
+    void SynthWorker::stop()
+    {
+        stopThread(2000);
+    }
+
+    void SynthWorker::start()
+    {
+        startThread();
+    }
+
+    void SynthWorker::prepare(double newSampleRate)
+    {
+        stopThread(2000);
+        sampleRate = newSampleRate;
+        useCounter = 0;
+
+        for (auto& slot : slots)
+        {
+            slot.state.store(Free, std::memory_order_relaxed);
+            slot.track = -1;
+            slot.users = 0;
+            slot.lastUsed = 0;
+            slot.sample = Sample();
+        }
+
+        startThread();
+    }
+
+    int SynthWorker::findSlot(int track, Instrument model, const InstrumentParams& params, bool readyOnly)
+    {
+        for (int i = 0; i < numSlots; ++i)
+        {
+            auto& slot = slots[i];
+            const int state = slot.state.load(std::memory_order_acquire);
+            if (state == Free || (readyOnly && state != Ready))
+                continue;
+
+            if (slot.track == track && slot.model == model && sameParams(slot.params, params))
+            {
+                slot.lastUsed = ++useCounter;
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    bool SynthWorker::request(int track, Instrument model, const InstrumentParams& params)
+    {
+        if (findSlot(track, model, params, false) >= 0)
+            return true;
+
+        const int victim = findVictim();
+        if (victim < 0)
+            return false;
+
+        auto& slot = slots[victim];
+        slot.track = track;
+        slot.model = model;
+        slot.params = params;
+        slot.lastUsed = ++useCounter;
+        slot.state.store(Queued, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    int SynthWorker::find(int track, Instrument model, const InstrumentParams& params)
+    {
+        return findSlot(track, model, params, true);
+    }
+
+    int SynthWorker::findVictim() const
+    {
+        int victim = -1;
+        for (int i = 0; i < numSlots; ++i)
+        {
+            const auto& slot = slots[i];
+            const int state = slot.state.load(std::memory_order_acquire);
+            if (state == Free)
+                return i;
+
+            if (state == Ready && slot.users == 0 && (victim < 0 || slot.lastUsed < slots[victim].lastUsed))
+                victim = i;
+        }
+
+        return victim;
+    }
+
+    const Sample& SynthWorker::getSample(int slot) const
+    {
+        return slots[slot].sample;
+    }
+
+    void SynthWorker::retain(int slot)
+    {
+        ++slots[slot].users;
+    }
+
+    void SynthWorker::release(int slot)
+    {
+        --slots[slot].users;
+    }
+
+    void SynthWorker::run()
+    {
+        while (!threadShouldExit())
+        {
+            bool rendered = false;
+            for (auto& slot : slots)
+            {
+                if (threadShouldExit())
+                    return;
+
+                if (slot.state.load(std::memory_order_acquire) != Queued)
+                    continue;
+
+                // The old buffer is freed here, off the audio thread.
+                slot.sample = sampleLibrary.render(slot.model, sampleRate, slot.params);
+                slot.state.store(Ready, std::memory_order_release);
+                rendered = true;
+            }
+
+            if (!rendered)
+                wait(50);
+        }
+    }
+
+    PatternSounds::PatternSounds()
+    {
+        for (auto& trackBinding : binding)
+            for (auto& variant : trackBinding)
+                variant = -1;
+    }
+
+    int PatternSounds::find(int track, int step, Instrument model, const InstrumentParams& params) const
+    {
+        const auto matches = [&](int index)
+        {
+            const auto& variant = variants.getReference(index);
+            return variant.track == track && variant.model == model && sameParams(variant.params, params);
+        };
+
+        if (step >= 0 && step < maxPatternSteps)
+        {
+            const int bound = binding[track][step];
+            if (bound >= 0 && matches(bound))
+                return bound;
+        }
+
+        for (int i = 0; i < variants.size(); ++i)
+            if (matches(i))
+                return i;
+
+        return -1;
+    }
+}
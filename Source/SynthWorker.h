@@ -0,0 +1,90 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Pattern.h"
+#include "Samples.h"
+
+namespace rb338
+{
+    // Renders instrument sounds for parameter sets the pattern is about to automate to, on a
+    // background thread, so the audio thread only has to swap in a finished buffer.
+    //
+    // Results live in a fixed pool of slots keyed by track, model and parameters. The audio
+    // thread claims a slot and fills in the key, the worker renders into it and marks it ready;
+    // neither side ever waits on the other. Ready slots stay cached for the next time the same
+    // values come round, and are reused least recently used first once nothing plays them.
+    class SynthWorker : private juce::Thread
+    {
+    public:
+        static constexpr int numSlots = 48;
+
+        explicit SynthWorker(const SampleLibrary& library);
+        ~SynthWorker() override;
+
+        void prepare(double sampleRate); // drops every cached sound and (re)starts the worker
+        void stop(); // before anything the renders read from changes
+        void start(); // after, keeping the cached sounds
+
+        // Audio thread. request returns false if every slot is busy; find returns the slot
+        // holding a finished render, or -1.
+        bool request(int track, Instrument model, const InstrumentParams& params);
+        int find(int track, Instrument model, const InstrumentParams& params);
+        const Sample& getSample(int slot) const;
+
+        // Audio thread: a slot in use by a voice or as a track's current sound is never reused.
+        void retain(int slot);
+        void release(int slot);
+
+    private:
+        enum SlotState
+        {
+            Free = 0,
+            Queued,
+            Ready
+        };
+
+        struct Slot
+        {
+            std::atomic<int> state { Free };
+            int track = -1;
+            Instrument model = Instrument::Kick;
+            InstrumentParams params;
+            Sample sample;
+            int users = 0; // audio thread only
+            juce::uint32 lastUsed = 0; // audio thread only
+        };
+
+        const SampleLibrary& sampleLibrary;
+        double sampleRate = 44100.0;
+        Slot slots[numSlots];
+        juce::uint32 useCounter = 0;
+
+        int findSlot(int track, Instrument model, const InstrumentParams& params, bool readyOnly);
+        int findVictim() const; // a free slot, else the least recently used ready one nothing plays
+        void run() override;
+    };
+
+    // Every sound a pattern's automation plays, rendered once when the pattern is loaded, and
+    // which of them each automated trig is bound to. Immutable once published.
+    struct PatternSounds
+    {
+        struct Variant
+        {
+            int track = -1;
+            Instrument model = Instrument::Kick;
+            InstrumentParams params;
+            Sample sample;
+        };
+
+        PatternSounds();
+
+        // The trig's bound variant if it was built for these settings, otherwise any variant
+        // that was; -1 if none. step may be -1 to only search.
+        int find(int track, int step, Instrument model, const InstrumentParams& params) const;
+
+        juce::uint64 version = 0;
+        double sampleRate = 0.0;
+        juce::Array<Variant> variants;
+        juce::int16 binding[maxTracks][maxPatternSteps]; // variant per automated trig, or -1
+    };
+}
@@ -0,0 +1,46 @@
+#include "Tempo.h"
+
+namespace rb338
+{
+    static double samplesPerStepAt(double bpm, double sampleRate)
+    {
+        // Steps are sixteenth notes.
+        return (60.0 / bpm) / 4.0 * sampleRate;
+    }
+
+    double TempoSegment::bpmAt(double phase) const
+    {
+        if (lengthSteps <= 0.0)
+            return endBpm;
+
+        const double t = juce::jlimit(0.0, 1.0, (phase - startPhase) / lengthSteps);
+        if (curve == TempoCurve::Exponential)
+            return startBpm * std::pow(endBpm / startBpm, t);
+        return startBpm + (endBpm - startBpm) * t;
+    }
+
+    double TempoSegment::timeAt(double phase, double sampleRate) const
+    {
+        const double u = phase - startPhase;
+        if (lengthSteps <= 0.0 || u <= 0.0 || startBpm == endBpm)
+            return startSample + u * samplesPerStepAt(u <= 0.0 ? startBpm : endBpm, sampleRate);
+
+        // Time is the integral of 1 / bpm over the ramped part of the phase, plus the hold after it.
+        const double k = samplesPerStepAt(1.0, sampleRate);
+        const double r = juce::jmin(u, lengthSteps);
+        double rampSamples = 0.0;
+
+        if (curve == TempoCurve::Exponential)
+        {
+            const double q = std::log(endBpm / startBpm) / lengthSteps;
+            rampSamples = k / (startBpm * q) * (1.0 - std::exp(-q * r));
+        }
+        else
+        {
+            const double slope = (endBpm - startBpm) / lengthSteps;
+            rampSamples = k / slope * std::log1p(slope * r / startBpm);
+        }
+
+        return startSample + rampSamples + (u - r) * samplesPerStepAt(endBpm, sampleRate);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+namespace rb338
+{
+    enum class TempoCurve
+    {
+        Linear = 0,
+        Exponential
+    };
+
+    // One stretch of the tempo map in the transport's phase domain, where phase counts steps.
+    // Tempo moves from startBpm to endBpm over lengthSteps, then holds at endBpm. Positions come
+    // from closed-form integrals of the step length, so a ramp costs no more per step than a
+    // fixed tempo and never accumulates rounding.
+    struct TempoSegment
+    {
+        double startSample = 0.0;
+        double startPhase = 0.0;
+        double startBpm = 120.0;
+        double endBpm = 120.0;
+        double lengthSteps = 0.0; // 0 = jump straight to endBpm
+        TempoCurve curve = TempoCurve::Linear;
+
+        double bpmAt(double phase) const;
+        double timeAt(double phase, double sampleRate) const; // sample position at which phase is reached
+    };
+}
@@ -0,0 +1,114 @@
+#include "Tracks.h"
+
+namespace rb338
+{
+    static juce::uint64 trackBit(int track)
+    {
+        return (juce::uint64)1 << track;
+    }
+
+    TrackRegistry::TrackRegistry()
+    {
+        static const char* const kitNames[builtInTracks] = {
+            "BD", "SD", "CP", "RS", "LT", "MT", "HT", "CH", "OH", "CR", "RD"
+        };
+
+        juce::uint64 kit = 0;
+        for (int track = 0; track < maxTracks; ++track)
+        {
+            const bool builtIn = track < builtInTracks;
+            info[track].model = builtIn ? (Instrument)track : Instrument::Kick;
+            info[track].name = builtIn ? juce::String(kitNames[track]) : juce::String();
+            models[track].store((int)info[track].model, std::memory_order_relaxed);
+            sources[track].store((int)TrackSource::Model, std::memory_order_relaxed);
+            if (builtIn)
+                kit |= trackBit(track);
+        }
+
+        active.store(kit, std::memory_order_release);
+    }
+
+    int TrackRegistry::findFreeSlot() const
+    {
+        const auto used = active.load(std::memory_order_relaxed);
+        for (int track = builtInTracks; track < maxTracks; ++track)
+            if ((used & trackBit(track)) == 0)
+                return track;
+
+        return -1;
+    }
+
+    bool TrackRegistry::claimSlot(int slot, const TrackInfo& newInfo)
+    {
+        if (slot < builtInTracks || slot >= maxTracks || isActive(TrackId(slot)))
+            return false;
+
+        info[slot] = newInfo;
+        models[slot].store((int)newInfo.model, std::memory_order_relaxed);
+        sources[slot].store((int)newInfo.source, std::memory_order_relaxed);
+        active.fetch_or(trackBit(slot), std::memory_order_release);
+        return true;
+    }
+
+    bool TrackRegistry::addModelTrack(int slot, Instrument model, const juce::String& name)
+    {
+        TrackInfo newInfo;
+        newInfo.name = name;
+        newInfo.source = TrackSource::Model;
+        newInfo.model = model;
+        return claimSlot(slot, newInfo);
+    }
+
+    bool TrackRegistry::addSampleTrack(int slot, const juce::File& file, Instrument borrowedModel)
+    {
+        TrackInfo newInfo;
+        newInfo.name = file.getFileNameWithoutExtension();
+        newInfo.source = TrackSource::UserSample;
+        newInfo.model = borrowedModel;
+        newInfo.sampleFile = file;
+        return claimSlot(slot, newInfo);
+    }
+
+    bool TrackRegistry::removeTrack(TrackId track)
+    {
+        if (!track.isValid() || track.isBuiltIn() || !isActive(track))
+            return false;
+
+        active.fetch_and(~trackBit(track.index), std::memory_order_release);
+        return true;
+    }
+
+    bool TrackRegistry::isActive(TrackId track) const
+    {
+        return track.isValid() && (active.load(std::memory_order_acquire) & trackBit(track.index)) != 0;
+    }
+
+    juce::uint64 TrackRegistry::getActiveMask() const
+    {
+        return active.load(std::memory_order_acquire);
+    }
+
+    int TrackRegistry::getNumActive() const
+    {
+        return juce::countNumberOfBits(getActiveMask());
+    }
+
+    Instrument TrackRegistry::getModel(TrackId track) const
+    {
+        if (!track.isValid())
+            return Instrument::Kick;
+        return (Instrument)models[track.index].load(std::memory_order_relaxed);
+    }
+
+    TrackSource TrackRegistry::getSource(TrackId track) const
+    {
+        if (!track.isValid())
+            return TrackSource::Model;
+        return (TrackSource)sources[track.index].load(std::memory_order_relaxed);
+    }
+
+    const TrackInfo& TrackRegistry::getInfo(TrackId track) const
+    {
+        return info[juce::jlimit(0, maxTracks - 1, track.index)];
+    }
+}
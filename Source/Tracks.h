@@ -0,0 +1,75 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Samples.h"
+
+namespace rb338
+{
+    // Tracks are what patterns sequence and the mixer mixes. The built-in kit fills the first
+    // tracks in Instrument order, so an Instrument is always the track of the same number. The
+    // remaining slots run another copy of a built-in model with their own settings, or play a
+    // user sample.
+    static constexpr int maxTracks = 64;
+    static constexpr int builtInTracks = (int)Instrument::Count;
+
+    // Names a track. Converts from Instrument implicitly, so code written against the built-in
+    // kit keeps working; extra tracks are named by index.
+    struct TrackId
+    {
+        int index = 0;
+
+        constexpr TrackId() = default;
+        constexpr TrackId(Instrument instrument) : index((int)instrument) {}
+        constexpr explicit TrackId(int trackIndex) : index(trackIndex) {}
+
+        constexpr bool isValid() const { return index >= 0 && index < maxTracks; }
+        constexpr bool isBuiltIn() const { return index >= 0 && index < builtInTracks; }
+        constexpr bool operator==(TrackId other) const { return index == other.index; }
+        constexpr bool operator!=(TrackId other) const { return index != other.index; }
+    };
+
+    enum class TrackSource
+    {
+        Model = 0,
+        UserSample
+    };
+
+    struct TrackInfo
+    {
+        juce::String name;
+        TrackSource source = TrackSource::Model;
+        Instrument model = Instrument::Kick; // sound model; user samples borrow its accent response
+        juce::File sampleFile;
+    };
+
+    // Which track slots are in use and what they play. Edited on the message thread; the audio
+    // thread only reads the active mask and each slot's model and source, which are published
+    // atomically.
+    class TrackRegistry
+    {
+    public:
+        TrackRegistry();
+
+        // Adding takes two steps, so the caller can give a slot its sound and settings before
+        // the audio thread sees it active: find a free slot, set it up, then add the track to it.
+        int findFreeSlot() const; // -1 when every slot is taken
+        bool addModelTrack(int slot, Instrument model, const juce::String& name);
+        bool addSampleTrack(int slot, const juce::File& file, Instrument borrowedModel);
+        bool removeTrack(TrackId track); // the built-in kit always stays
+
+        bool isActive(TrackId track) const;
+        juce::uint64 getActiveMask() const;
+        int getNumActive() const;
+        Instrument getModel(TrackId track) const;
+        TrackSource getSource(TrackId track) const;
+        const TrackInfo& getInfo(TrackId track) const; // message thread
+
+    private:
+        TrackInfo info[maxTracks];
+        std::atomic<int> models[maxTracks];
+        std::atomic<int> sources[maxTracks];
+        std::atomic<juce::uint64> active { 0 };
+
+        bool claimSlot(int slot, const TrackInfo& newInfo);
+    };
+}
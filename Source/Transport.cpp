@@ -0,0 +1,51 @@
+#include "Transport.h"
+
+namespace rb338
+{
+    double TransportPosition::getHeardPhase(double timeMs) const
+    {
+        if (!running || bpm <= 0.0)
+            return phase;
+
+        const double samplesPerStep = 60.0 / bpm / 4.0 * sampleRate;
+        const double elapsed = (timeMs - publishedMs) * 0.001 * sampleRate;
+        return phase + (elapsed - (double)outputLatency) / samplesPerStep;
+    }
+
+    void TransportState::publish(const TransportPosition& position)
+    {
+        juce::uint64 packed[numWords] = {};
+        std::memcpy(packed, &position, sizeof(position));
+
+        const auto start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < numWords; ++i)
+            words[i].store(packed[i], std::memory_order_relaxed);
+
+        sequence.store(start + 2, std::memory_order_release);
+    }
+
+    TransportPosition TransportState::read() const
+    {
+        juce::uint64 packed[numWords] = {};
+        for (;;)
+        {
+            const auto before = sequence.load(std::memory_order_acquire);
+            if ((before & 1) != 0)
+                continue;
+
+            for (size_t i = 0; i < numWords; ++i)
+                packed[i] = words[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before)
+                break;
+        }
+
+        TransportPosition position;
+        std::memcpy(&position, packed, sizeof(position));
+        return position;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <type_traits>
+
+namespace rb338
+{
+    // Where the transport was at the end of the last rendered block. Bars are 16 steps and beats
+    // are 4 steps; counts start at zero from the first step.
+    struct TransportPosition
+    {
+        bool running = false;
+        bool externalSync = false;
+        double sampleRate = 44100.0;
+        juce::int64 samplePosition = 0; // samples rendered since the transport started
+        double phase = 0.0; // steps since start on the ideal grid, negative before the first step
+        int step = 0; // pattern step that sounded last
+        int bar = 0;
+        int beat = 0;
+        double bpm = 0.0;
+        int outputLatency = 0; // samples between rendering and hearing
+        double publishedMs = 0.0; // Time::getMillisecondCounterHiRes when this was published
+
+        // Phase coming out of the speakers at a given time, extrapolated at the current tempo.
+        double getHeardPhase(double timeMs) const;
+    };
+
+    // Single-writer sequence lock. The audio thread publishes without waiting; readers on any
+    // thread retry on the rare occasion they overlap a write, so they never see a torn position.
+    class TransportState
+    {
+    public:
+        void publish(const TransportPosition& position); // one writer only
+        TransportPosition read() const;
+
+    private:
+        static_assert(std::is_trivially_copyable<TransportPosition>::value, "copied word by word");
+        static constexpr size_t numWords = (sizeof(TransportPosition) + sizeof(juce::uint64) - 1) / sizeof(juce::uint64);
+
+        std::atomic<juce::uint32> sequence { 0 };
+        std::atomic<juce::uint64> words[numWords] = {};
+    };
+}
@@ -0,0 +1,125 @@
+#include <JuceHeader.h>
+#include "MidiClock.h"
+
+namespace rb338
+{
+    // Feeds the follower clock as a driver would deliver it, each pulse up to a millisecond off
+    // its ideal time, and checks the tempo and pulse times it recovers.
+    class MidiClockFollowerTests : public juce::UnitTest
+    {
+    public:
+        MidiClockFollowerTests() : juce::UnitTest("MidiClockFollower", "LoS9x9") {}
+
+        void runTest() override
+        {
+            constexpr double sampleRate = 48000.0;
+            const double jitter = 0.001 * sampleRate;
+
+            beginTest("Locks to steady clock");
+            {
+                MidiClockFollower follower;
+                follower.prepare(sampleRate);
+                juce::Random random(1);
+                const double period = pulseLength(120.0, sampleRate);
+
+                for (int i = 0; i < MidiClockFollower::pulsesPerQuarter - 1; ++i)
+                    follower.pulse(i * period + (random.nextDouble() * 2.0 - 1.0) * jitter);
+                expect(!follower.isLocked(), "not locked before a full beat");
+
+                double time = 0.0;
+                for (int i = MidiClockFollower::pulsesPerQuarter - 1; i < 16 * MidiClockFollower::pulsesPerQuarter; ++i)
+                {
+                    time = i * period;
+                    follower.pulse(time + (random.nextDouble() * 2.0 - 1.0) * jitter);
+                }
+
+                expect(follower.isLocked());
+                expectWithinAbsoluteError(follower.getBpm(), 120.0, 0.15);
+                expectWithinAbsoluteError(follower.getPulseTime((double)follower.getNextPulse()), time + period, 0.75 * jitter);
+            }
+
+            beginTest("Follows a tempo change");
+            {
+                MidiClockFollower follower;
+                follower.prepare(sampleRate);
+                juce::Random random(2);
+                double time = 0.0;
+                for (int i = 0; i < 8 * MidiClockFollower::pulsesPerQuarter; ++i)
+                {
+                    follower.pulse(time + (random.nextDouble() * 2.0 - 1.0) * jitter);
+                    time += pulseLength(120.0, sampleRate);
+                }
+
+                for (int i = 0; i < 8 * MidiClockFollower::pulsesPerQuarter; ++i)
+                {
+                    follower.pulse(time + (random.nextDouble() * 2.0 - 1.0) * jitter);
+                    time += pulseLength(126.0, sampleRate);
+                }
+
+                expect(follower.isLocked(), "a small change keeps the lock");
+                expectWithinAbsoluteError(follower.getBpm(), 126.0, 0.2);
+            }
+
+            beginTest("Starts over after missed pulses");
+            {
+                MidiClockFollower follower;
+                follower.prepare(sampleRate);
+                const double period = pulseLength(120.0, sampleRate);
+                for (int i = 0; i < 4 * MidiClockFollower::pulsesPerQuarter; ++i)
+                    follower.pulse(i * period);
+                expect(follower.isLocked());
+
+                const double resume = (4 * MidiClockFollower::pulsesPerQuarter + 6) * period;
+                follower.pulse(resume);
+                expect(!follower.isLocked(), "a gap of several pulses drops the lock");
+
+                for (int i = 1; i <= MidiClockFollower::pulsesPerQuarter; ++i)
+                    follower.pulse(resume + i * period);
+                expect(follower.isLocked(), "locked again a beat later");
+                expectWithinAbsoluteError(follower.getBpm(), 120.0, 0.01);
+            }
+
+            beginTest("Drops the lock when clock stops");
+            {
+                MidiClockFollower follower;
+                follower.prepare(sampleRate);
+                const double period = pulseLength(120.0, sampleRate);
+                const int count = 4 * MidiClockFollower::pulsesPerQuarter;
+                for (int i = 0; i < count; ++i)
+                    follower.pulse(i * period);
+
+                follower.advanceTo(count * period);
+                expect(follower.isLocked(), "one late pulse is not a stop");
+
+                follower.advanceTo((count - 1) * period + 0.3 * sampleRate);
+                expect(!follower.isLocked());
+                expectEquals(follower.getBpm(), 0.0);
+            }
+
+            beginTest("Numbers pulses from Start");
+            {
+                MidiClockFollower follower;
+                follower.prepare(sampleRate);
+                const double period = pulseLength(120.0, sampleRate);
+                const juce::int64 songPosition = 6 * MidiClockFollower::pulsesPerQuarter;
+                follower.start(songPosition);
+
+                const int count = 4 * MidiClockFollower::pulsesPerQuarter;
+                for (int i = 0; i < count; ++i)
+                    follower.pulse(i * period);
+
+                expectEquals(follower.getNextPulse(), songPosition + count);
+                expectWithinAbsoluteError(follower.getPulseTime((double)songPosition), 0.0, 1.0);
+                expectWithinAbsoluteError(follower.getPulseTime((double)(songPosition + count + 24)), (count + 24) * period, 1.0);
+            }
+        }
+
+    private:
+        static double pulseLength(double bpm, double sampleRate)
+        {
+            return 60.0 * sampleRate / (bpm * MidiClockFollower::pulsesPerQuarter);
+        }
+    };
+
+    static MidiClockFollowerTests midiClockFollowerTests;
+}
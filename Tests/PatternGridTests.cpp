@@ -0,0 +1,246 @@
+#include <JuceHeader.h>
+#include "Pattern.h"
+
+namespace rb338
+{
+    // Checks the bitmask row edits and comparisons against the same edits made one cell at a
+    // time on a plain copy of the track, over random tracks, lengths and amounts.
+    class PatternGridTests : public juce::UnitTest
+    {
+    public:
+        PatternGridTests() : juce::UnitTest("PatternGrid", "LoS9x9") {}
+
+        void runTest() override
+        {
+            static constexpr int rounds = 500;
+            juce::Random random(26);
+            auto grid = std::make_unique<PatternGrid>();
+
+            beginTest("Rotate");
+            for (int round = 0; round < rounds; ++round)
+            {
+                const auto track = fill(*grid, random);
+                const int length = 1 + random.nextInt(maxPatternSteps);
+                const int amount = random.nextInt(4 * maxPatternSteps + 1) - 2 * maxPatternSteps;
+                const auto before = readTrack(*grid, track);
+                grid->rotateTrack(track, length, amount);
+
+                Cells expected = before;
+                for (int step = 0; step < length; ++step)
+                    expected.cells[(((step + amount) % length) + length) % length] = before.cells[step];
+                expectTrack(*grid, track, expected, "rotate " + juce::String(amount) + " over " + juce::String(length));
+            }
+
+            beginTest("Shift");
+            for (int round = 0; round < rounds; ++round)
+            {
+                const auto track = fill(*grid, random);
+                const int length = 1 + random.nextInt(maxPatternSteps);
+                const int amount = random.nextInt(2 * length + 5) - length - 2;
+                const auto before = readTrack(*grid, track);
+                grid->shiftTrack(track, length, amount);
+
+                Cells expected = before;
+                for (int step = 0; step < length; ++step)
+                {
+                    const int source = step - amount;
+                    expected.cells[step] = source >= 0 && source < length ? before.cells[source] : Cell();
+                }
+                expectTrack(*grid, track, expected, "shift " + juce::String(amount) + " over " + juce::String(length));
+            }
+
+            beginTest("Invert");
+            for (int round = 0; round < rounds; ++round)
+            {
+                const auto track = fill(*grid, random);
+                const int length = 1 + random.nextInt(maxPatternSteps);
+                const auto before = readTrack(*grid, track);
+                grid->invertTrack(track, length);
+
+                // Only the trigs flip; automation stays where it was.
+                Cells expected = before;
+                for (int step = 0; step < length; ++step)
+                {
+                    auto& cell = expected.cells[step];
+                    cell.state = cell.state == StepState::Off ? StepState::On : StepState::Off;
+                    cell.flam = false;
+                    cell.timing = 0.0f;
+                }
+                expectTrack(*grid, track, expected, "invert over " + juce::String(length));
+            }
+
+            beginTest("Mirror");
+            for (int round = 0; round < rounds; ++round)
+            {
+                const auto track = fill(*grid, random);
+                const int length = 1 + random.nextInt(maxPatternSteps);
+                const auto before = readTrack(*grid, track);
+                grid->mirrorTrack(track, length);
+
+                Cells expected = before;
+                for (int step = 0; step < length; ++step)
+                    expected.cells[step] = before.cells[length - 1 - step];
+                expectTrack(*grid, track, expected, "mirror over " + juce::String(length));
+            }
+
+            beginTest("Copy");
+            {
+                auto source = std::make_unique<PatternGrid>();
+                for (int round = 0; round < rounds; ++round)
+                {
+                    const auto from = fill(*source, random);
+                    const auto to = fill(*grid, random);
+                    const auto otherTrack = TrackId((to.index + 1) % maxTracks);
+                    const auto untouched = readTrack(*grid, otherTrack);
+                    grid->copyTrack(*source, from, to);
+
+                    expectTrack(*grid, to, readTrack(*source, from), "copy");
+                    expectTrack(*grid, otherTrack, untouched, "copy left the other tracks alone");
+                }
+            }
+
+            beginTest("Compare");
+            {
+                auto other = std::make_unique<PatternGrid>();
+                for (int round = 0; round < rounds; ++round)
+                {
+                    grid->clear();
+                    grid->clearAllAutomation();
+                    grid->clearTempoAutomation();
+                    const auto track = fill(*grid, random);
+                    if (random.nextBool())
+                        grid->setTempoPoint(random.nextInt(maxPatternSteps), 40.0f + random.nextFloat() * 160.0f);
+
+                    *other = *grid;
+                    const auto changedTrack = random.nextInt(4) == 0 ? TrackId(random.nextInt(maxTracks)) : track;
+                    change(*other, changedTrack, random);
+
+                    const auto a = readTrack(*grid, changedTrack);
+                    const auto b = readTrack(*other, changedTrack);
+                    StepMask differs = 0;
+                    for (int step = 0; step < maxPatternSteps; ++step)
+                        if (a.cells[step].state != b.cells[step].state || a.cells[step].flam != b.cells[step].flam)
+                            differs |= StepBits::bit(step);
+                    expectEquals((juce::int64)grid->diffSteps(*other, changedTrack), (juce::int64)differs, "diffSteps");
+                    expect(grid->trackEquals(*other, changedTrack) == (a == b), "trackEquals");
+
+                    bool tempoEqual = true;
+                    for (int step = 0; step < maxPatternSteps; ++step)
+                    {
+                        float x = 0.0f, y = 0.0f;
+                        const bool hasX = grid->getTempoPoint(step, x);
+                        const bool hasY = other->getTempoPoint(step, y);
+                        tempoEqual = tempoEqual && hasX == hasY && x == y;
+                    }
+                    expect((*grid == *other) == (a == b && tempoEqual), "operator==");
+                }
+            }
+        }
+
+    private:
+        static constexpr int numParams = (int)AutomationParam::Count;
+
+        struct Cell
+        {
+            StepState state = StepState::Off;
+            bool flam = false;
+            float timing = 0.0f;
+            bool automated[numParams] = {};
+            float value[numParams] = {};
+
+            bool operator==(const Cell& other) const
+            {
+                if (state != other.state || flam != other.flam || timing != other.timing)
+                    return false;
+                for (int p = 0; p < numParams; ++p)
+                    if (automated[p] != other.automated[p] || (automated[p] && value[p] != other.value[p]))
+                        return false;
+                return true;
+            }
+        };
+
+        struct Cells
+        {
+            Cell cells[maxPatternSteps];
+
+            bool operator==(const Cells& other) const
+            {
+                for (int step = 0; step < maxPatternSteps; ++step)
+                    if (!(cells[step] == other.cells[step]))
+                        return false;
+                return true;
+            }
+        };
+
+        static Cells readTrack(const PatternGrid& grid, TrackId track)
+        {
+            Cells result;
+            for (int step = 0; step < maxPatternSteps; ++step)
+            {
+                auto& cell = result.cells[step];
+                cell.state = grid.getStep(track, step);
+                cell.flam = grid.getFlam(track, step);
+                cell.timing = grid.getMicrotiming(track, step);
+                for (int p = 0; p < numParams; ++p)
+                    cell.automated[p] = grid.getAutomationPoint(track, (AutomationParam)p, step, cell.value[p]);
+            }
+            return result;
+        }
+
+        // A random track of trigs, flams, nudges and automation over all the steps.
+        static TrackId fill(PatternGrid& grid, juce::Random& random)
+        {
+            const TrackId track(random.nextInt(maxTracks));
+            grid.clearTrack(track);
+            grid.clearAutomation(track);
+            const float density = random.nextFloat();
+            for (int step = 0; step < maxPatternSteps; ++step)
+            {
+                if (random.nextFloat() < density)
+                {
+                    grid.setStep(track, step, random.nextBool() ? StepState::Accent : StepState::On);
+                    grid.setFlam(track, step, random.nextInt(3) == 0);
+                    if (random.nextBool())
+                        grid.setMicrotiming(track, step, random.nextFloat() - 0.5f);
+                }
+
+                for (int p = 0; p < numParams; ++p)
+                    if (random.nextInt(4) == 0)
+                        grid.setAutomationPoint(track, (AutomationParam)p, step, random.nextFloat());
+            }
+            return track;
+        }
+
+        // One random edit to one cell, or none at all.
+        static void change(PatternGrid& grid, TrackId track, juce::Random& random)
+        {
+            const int step = random.nextInt(maxPatternSteps);
+            const auto param = (AutomationParam)random.nextInt(numParams);
+            switch (random.nextInt(6))
+            {
+                case 0: grid.cycleStep(track, step); break;
+                case 1: grid.setFlam(track, step, !grid.getFlam(track, step)); break;
+                case 2: grid.setMicrotiming(track, step, random.nextFloat() - 0.5f); break;
+                case 3: grid.setAutomationPoint(track, param, step, random.nextFloat()); break;
+                case 4: grid.setTempoPoint(step, 40.0f + random.nextFloat() * 160.0f); break;
+                default: break;
+            }
+        }
+
+        void expectTrack(const PatternGrid& grid, TrackId track, const Cells& expected, const juce::String& what)
+        {
+            const auto actual = readTrack(grid, track);
+            for (int step = 0; step < maxPatternSteps; ++step)
+            {
+                if (!(actual.cells[step] == expected.cells[step]))
+                {
+                    expect(false, what + ": step " + juce::String(step) + " of track " + juce::String(track.index));
+                    return;
+                }
+            }
+            expect(true);
+        }
+    };
+
+    static PatternGridTests patternGridTests;
+}
@@ -0,0 +1,119 @@
+#include <JuceHeader.h>
+#include "Sequencer.h"
+
+namespace rb338
+{
+    // Runs the sequencer for 24 simulated hours and checks every hit and clock pulse against its
+    // closed-form position, so any rounding that builds up over a long set shows as drift.
+    class SequencerDriftTests : public juce::UnitTest
+    {
+    public:
+        SequencerDriftTests() : juce::UnitTest("SequencerDrift", "LoS9x9") {}
+
+        void runTest() override
+        {
+            constexpr double bpm = 123.0; // a step is a fraction of a sample long at every rate
+            constexpr float shuffle = 0.4f;
+            // Each rate with a fixed block size, none of which divide a step, and with a host that
+            // changes the size every block (0).
+            const std::pair<double, int> runs[] = { { 44100.0, 64 }, { 44100.0, 0 }, { 48000.0, 441 },
+                                                    { 48000.0, 0 }, { 96000.0, 4096 }, { 96000.0, 0 } };
+
+            for (const auto& run : runs)
+            {
+                beginTest(juce::String(run.first, 0) + " Hz, " + (run.second > 0 ? juce::String(run.second) : juce::String("varying"))
+                          + " sample blocks");
+                runDay(run.first, run.second, bpm, shuffle);
+            }
+        }
+
+    private:
+        void runDay(double sampleRate, int blockSize, double bpm, float shuffle)
+        {
+            Sequencer sequencer;
+            sequencer.prepare(sampleRate);
+            sequencer.setBpm((float)bpm);
+            sequencer.setShuffle(shuffle);
+            for (int step = 0; step < sequencer.getLength(); ++step)
+                sequencer.setStep(TrackId(Instrument::Kick), step, StepState::On);
+            sequencer.setRunning(true);
+
+            // Step n sounds one step after start, off-beats late by the shuffle, and every fourth
+            // step within a millisecond of analog drift.
+            const long double stepLength = 60.0L * sampleRate / (bpm * 4.0L);
+            const long double shuffleDelay = stepLength * shuffle * 0.33L;
+            const long double driftLimit = 0.001L * sampleRate;
+            const juce::int64 daySamples = (juce::int64)(24.0 * 60.0 * 60.0 * sampleRate);
+
+            juce::Array<ScheduledEvent> events;
+            juce::Array<ClockMessage> clock;
+            events.ensureStorageAllocated(Sequencer::maxScheduledEvents);
+            clock.ensureStorageAllocated(256);
+
+            juce::Random random(7);
+            juce::int64 blockStart = 0;
+            juce::int64 hits = 0, pulses = 0;
+            long double latestHit = 0.0L, latestPulse = 0.0L;
+            bool started = false;
+            while (blockStart < daySamples)
+            {
+                const int numSamples = blockSize > 0 ? blockSize : 16 + random.nextInt(2048);
+                sequencer.acquirePattern();
+                sequencer.renderBlock(numSamples, events, clock);
+
+                for (const auto& scheduled : events)
+                {
+                    const juce::int64 n = hits++;
+                    const int step = (int)(n % sequencer.getLength());
+                    const long double ideal = (long double)(n + 1) * stepLength + (step % 2 == 1 ? shuffleDelay : 0.0L);
+                    const long double error = (long double)scheduled.samplePosition - ideal;
+                    const long double allowed = step % 4 == 0 ? driftLimit : 0.0L;
+                    if (error < -allowed - 1.0e-6L || error > allowed + 1.0L + 1.0e-6L)
+                    {
+                        expect(false, "step " + juce::String(n) + " at " + juce::String(scheduled.samplePosition)
+                                          + ", ideal " + juce::String((double)ideal, 3));
+                        return;
+                    }
+                    if (step % 4 != 0)
+                        latestHit = juce::jmax(latestHit, error);
+                }
+
+                for (const auto& message : clock)
+                {
+                    if (message.type == ClockMessage::Type::Start)
+                    {
+                        started = true;
+                        continue;
+                    }
+
+                    // Pulses sit on the ideal grid, six to a step, and are rounded up to a sample.
+                    const juce::int64 k = pulses++;
+                    const long double ideal = ((long double)k / Sequencer::clockPulsesPerStep + 1.0L) * stepLength;
+                    const long double error = (long double)(blockStart + message.offset) - ideal;
+                    if (error < -1.0e-6L || error > 1.0L + 1.0e-6L)
+                    {
+                        expect(false, "pulse " + juce::String(k) + " at " + juce::String(blockStart + message.offset)
+                                          + ", ideal " + juce::String((double)ideal, 3));
+                        return;
+                    }
+                    latestPulse = juce::jmax(latestPulse, error);
+                }
+
+                blockStart += numSamples;
+            }
+
+            const juce::int64 expectedSteps = (juce::int64)std::floor((long double)daySamples / stepLength) - 1;
+            expect(started, "the run began with a Start");
+            expect(std::abs(hits - expectedSteps) <= 1, "every step of the day played: " + juce::String(hits) + " of " + juce::String(expectedSteps));
+            expect(std::abs(pulses - expectedSteps * Sequencer::clockPulsesPerStep) <= Sequencer::clockPulsesPerStep,
+                   "every pulse of the day was sent: " + juce::String(pulses));
+            expectEquals(sequencer.getDroppedEvents(), 0);
+            expectEquals(sequencer.getDroppedClockPulses(), 0);
+
+            logMessage(juce::String(hits) + " steps, latest undrifted hit " + juce::String((double)latestHit, 4)
+                       + " samples and latest pulse " + juce::String((double)latestPulse, 4) + " samples after ideal");
+        }
+    };
+
+    static SequencerDriftTests sequencerDriftTests;
+}
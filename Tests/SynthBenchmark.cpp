@@ -0,0 +1,121 @@
+#include <JuceHeader.h>
+#include "DspPrimitives.h"
+#include "Samples.h"
+
+// Times every generator on the fast DSP primitives against the closed forms they replace, and
+// the primitives themselves, so a change to either can be measured. Every render uses settings
+// no earlier one did, so the memoised stages start cold each time.
+// Usage: LoS9x9Benchmark [sample rate] [renders per instrument]
+namespace
+{
+    using namespace rb338;
+
+    template <typename Function>
+    double timeMs(Function&& function)
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        function();
+        return juce::Time::getMillisecondCounterHiRes() - start;
+    }
+
+    InstrumentParams settingsFor(int index, int count)
+    {
+        InstrumentParams params;
+        params.tune = ((float)index + 0.5f) / (float)count;
+        params.decay = 0.5f;
+        params.tone = 1.0f - params.tune;
+        params.snappy = 0.5f;
+        return params;
+    }
+
+    // Each primitive against the std:: call it replaces, over a million samples. The sums are
+    // printed so the loops are not optimised away.
+    void benchmarkPrimitives(double sampleRate)
+    {
+        constexpr int count = 1000000;
+        float sink = 0.0f;
+
+        const double expMs = timeMs([&]
+        {
+            for (int i = 0; i < count; ++i)
+                sink += std::exp(-3.0f * (float)i / (float)sampleRate);
+        });
+        const double decayMs = timeMs([&]
+        {
+            dsp::ExpDecay decay(3.0f, sampleRate);
+            for (int i = 0; i < count; ++i)
+                sink += decay.next();
+        });
+
+        const double fmodMs = timeMs([&]
+        {
+            float phase = 0.0f;
+            for (int i = 0; i < count; ++i)
+            {
+                phase += juce::MathConstants<float>::twoPi * 440.0f / (float)sampleRate;
+                sink += std::fmod(phase, juce::MathConstants<float>::twoPi) < juce::MathConstants<float>::pi ? 1.0f : -1.0f;
+            }
+        });
+        const double phasorMs = timeMs([&]
+        {
+            dsp::Phasor phasor(440.0f, sampleRate);
+            for (int i = 0; i < count; ++i)
+                sink += dsp::square(phasor.advance());
+        });
+
+        const double randomMs = timeMs([&]
+        {
+            juce::Random random(1983);
+            for (int i = 0; i < count; ++i)
+                sink += random.nextFloat() * 2.0f - 1.0f;
+        });
+        const double noiseMs = timeMs([&]
+        {
+            dsp::Noise noise(1983);
+            for (int i = 0; i < count; ++i)
+                sink += noise.next();
+        });
+
+        std::printf("%-22s %10s %10s %9s\n", "primitive, 1M samples", "std ms", "dsp ms", "speed-up");
+        std::printf("%-22s %10.2f %10.2f %8.1fx\n", "exp decay", expMs, decayMs, expMs / decayMs);
+        std::printf("%-22s %10.2f %10.2f %8.1fx\n", "square phase", fmodMs, phasorMs, fmodMs / phasorMs);
+        std::printf("%-22s %10.2f %10.2f %8.1fx\n", "white noise", randomMs, noiseMs, randomMs / noiseMs);
+        std::printf("(checksum %g)\n\n", (double)sink);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const double sampleRate = argc > 1 ? juce::jlimit(8000.0, 384000.0, juce::String(argv[1]).getDoubleValue()) : 48000.0;
+    const int renders = argc > 2 ? juce::jlimit(1, 256, juce::String(argv[2]).getIntValue()) : 8;
+    const char* names[] = { "Kick", "Snare", "Clap", "Rim", "Low tom", "Mid tom", "High tom",
+                            "Closed hat", "Open hat", "Crash", "Ride" };
+
+    std::printf("LoS.9x9 synthesis benchmark, %.0f Hz, %d renders per instrument\n\n", sampleRate, renders);
+    benchmarkPrimitives(sampleRate);
+
+    SampleLibrary library;
+    double referenceTotal = 0.0;
+    double fastTotal = 0.0;
+    std::printf("%-22s %10s %10s %9s\n", "generator, per render", "ref ms", "fast ms", "speed-up");
+    for (int model = 0; model < (int)Instrument::Count; ++model)
+    {
+        // Each side takes its own half of the settings range, so no render finds its stages built.
+        const double referenceMs = timeMs([&]
+        {
+            for (int i = 0; i < renders; ++i)
+                library.renderReference((Instrument)model, sampleRate, settingsFor(i, renders * 2));
+        }) / renders;
+        const double fastMs = timeMs([&]
+        {
+            for (int i = 0; i < renders; ++i)
+                library.renderUncached((Instrument)model, sampleRate, settingsFor(renders + i, renders * 2));
+        }) / renders;
+
+        referenceTotal += referenceMs;
+        fastTotal += fastMs;
+        std::printf("%-22s %10.3f %10.3f %8.1fx\n", names[model], referenceMs, fastMs, referenceMs / fastMs);
+    }
+    std::printf("%-22s %10.3f %10.3f %8.1fx\n", "All", referenceTotal, fastTotal, referenceTotal / fastTotal);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <JuceHeader.h>
+#include "Samples.h"
+
+namespace rb338
+{
+    // Renders every instrument on the fast DSP primitives and on the closed forms they replace,
+    // over a spread of settings and rates, and checks the two stay within a tolerance.
+    class SynthesisAccuracyTests : public juce::UnitTest
+    {
+    public:
+        SynthesisAccuracyTests() : juce::UnitTest("SynthesisAccuracy", "LoS9x9") {}
+
+        void runTest() override
+        {
+            const std::pair<OscillatorQuality, const char*> qualities[] = { { OscillatorQuality::BandLimited, "band-limited" },
+                                                                            { OscillatorQuality::Naive, "naive" } };
+            for (const auto& quality : qualities)
+            {
+                SampleLibrary library;
+                library.setOscillatorQuality(quality.first);
+
+                for (int model = 0; model < (int)Instrument::Count; ++model)
+                {
+                    beginTest(juce::String(names[model]) + ", " + quality.second + " oscillators");
+                    const double tolerance = toleranceFor((Instrument)model, quality.first);
+
+                    double worst = 0.0;
+                    for (const double sampleRate : { 44100.0, 48000.0, 96000.0 })
+                    {
+                        for (int setting = 0; setting < 5; ++setting)
+                        {
+                            InstrumentParams params;
+                            params.tune = (float)setting / 4.0f;
+                            params.decay = 1.0f - (float)setting / 4.0f;
+                            params.tone = 0.2f + (float)setting * 0.15f;
+                            params.snappy = 0.3f + (float)setting * 0.1f;
+
+                            const auto fast = library.renderUncached((Instrument)model, sampleRate, params);
+                            const auto reference = library.renderReference((Instrument)model, sampleRate, params);
+                            expectEquals(fast.data.getNumSamples(), reference.data.getNumSamples());
+                            if (fast.data.getNumSamples() != reference.data.getNumSamples())
+                                return;
+
+                            worst = juce::jmax(worst, relativeError(fast, reference));
+                        }
+                    }
+
+                    expectLessOrEqual(worst, tolerance, "RMS difference relative to the reference");
+                    logMessage("worst relative RMS difference " + juce::String(worst, 8));
+                }
+            }
+        }
+
+    private:
+        static constexpr const char* names[] = { "Kick", "Snare", "Clap", "Rim", "Low tom", "Mid tom", "High tom",
+                                                  "Closed hat", "Open hat", "Crash", "Ride" };
+
+        // Voices built on the 6-bit metal sources differ most: a phase a rounding error apart
+        // can put a square edge, and so a quantisation step, one sample earlier. Whether they
+        // still sound as they did is SynthesisBaseline's to check.
+        static double toleranceFor(Instrument model, OscillatorQuality quality)
+        {
+            switch (model)
+            {
+                case Instrument::ClosedHat:
+                case Instrument::OpenHat:
+                case Instrument::Crash:
+                case Instrument::Ride:
+                    return quality == OscillatorQuality::Naive ? 5.0e-2 : 1.5e-2;
+                default:
+                    return 2.0e-3;
+            }
+        }
+
+        static double relativeError(const Sample& fast, const Sample& reference)
+        {
+            double difference = 0.0;
+            double level = 0.0;
+            for (int channel = 0; channel < reference.data.getNumChannels(); ++channel)
+            {
+                const float* a = fast.data.getReadPointer(channel);
+                const float* b = reference.data.getReadPointer(channel);
+                for (int i = 0; i < reference.data.getNumSamples(); ++i)
+                {
+                    difference += ((double)a[i] - (double)b[i]) * ((double)a[i] - (double)b[i]);
+                    level += (double)b[i] * (double)b[i];
+                }
+            }
+            return level > 0.0 ? std::sqrt(difference / level) : std::sqrt(difference);
+        }
+    };
+
+    static SynthesisAccuracyTests synthesisAccuracyTests;
+}
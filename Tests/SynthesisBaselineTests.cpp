@@ -0,0 +1,290 @@
+#include <JuceHeader.h>
+#include "Samples.h"
+#include <complex>
+#include <vector>
+
+namespace rb338
+{
+    // Compares every instrument with what the synthesis put out before it moved to the fast DSP
+    // primitives (2171d8d). The noise generator changed with them, so no sample lines up; what
+    // has to stay is each sound's length, its level over time and how its energy spreads over
+    // the spectrum. Switching the old juce::Random noise to another seed moves the clap by up to
+    // 1.7 dB in level, 0.8 dB in loudness and 2.2 dB in a band, and the tolerances sit just
+    // above that.
+    class SynthesisBaselineTests : public juce::UnitTest
+    {
+    public:
+        SynthesisBaselineTests() : juce::UnitTest("SynthesisBaseline", "LoS9x9") {}
+
+        void runTest() override
+        {
+            // The baseline only had the naive oscillators; band-limiting them changed the sound on purpose.
+            SampleLibrary library;
+            library.setOscillatorQuality(OscillatorQuality::Naive);
+
+            for (int model = 0; model < (int)Instrument::Count; ++model)
+            {
+                beginTest(names[model]);
+                for (int setting = 0; setting < numSettings; ++setting)
+                {
+                    InstrumentParams params;
+                    params.tune = settings[setting][0];
+                    params.decay = settings[setting][1];
+                    params.tone = settings[setting][2];
+                    params.snappy = settings[setting][3];
+
+                    const auto sound = library.renderUncached((Instrument)model, sampleRate, params);
+                    const auto& expected = baseline[model][setting];
+                    const auto measured = profile(sound.data, sampleRate);
+                    const auto where = juce::String(" at setting ") + juce::String(setting);
+
+                    expectEquals(sound.data.getNumSamples(), expected.length, "length" + where);
+                    expectWithinAbsoluteError(measured.loudest, expected.loudest, loudestTolerance, "loudest window" + where);
+                    expectClose(measured.level, expected.level, SoundProfile::numWindows, levelFloor, levelTolerance, "level" + where);
+                    expectClose(measured.bands, expected.bands, SoundProfile::numBands, bandFloor, bandTolerance, "spectrum" + where);
+                }
+            }
+        }
+
+    private:
+        static constexpr const char* names[] = { "Kick", "Snare", "Clap", "Rim", "Low tom", "Mid tom", "High tom",
+                                                  "Closed hat", "Open hat", "Crash", "Ride" };
+
+        static constexpr double sampleRate = 44100.0;
+        static constexpr int numSettings = 3;
+        static constexpr float settings[numSettings][4] = { { 0.5f, 0.5f, 0.5f, 0.5f }, // tune, decay, tone, snappy
+                                                            { 0.2f, 0.8f, 0.3f, 0.7f },
+                                                            { 0.9f, 0.2f, 0.8f, 0.3f } };
+
+        static constexpr float loudestTolerance = 1.0f;
+        // Windows and bands quieter than the floor on both sides are not compared.
+        static constexpr float levelFloor = -40.0f;
+        static constexpr float levelTolerance = 2.0f;
+        static constexpr float bandFloor = -30.0f;
+        static constexpr float bandTolerance = 2.5f;
+
+        void expectClose(const float* measured, const float* expected, int count, float floor, float tolerance, const juce::String& what)
+        {
+            float worst = 0.0f;
+            int worstIndex = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                const float difference = std::abs(juce::jmax(measured[i], floor) - juce::jmax(expected[i], floor));
+                if (difference > worst)
+                {
+                    worst = difference;
+                    worstIndex = i;
+                }
+            }
+
+            expectLessOrEqual(worst, tolerance, what + ", " + juce::String(measured[worstIndex], 1) + " dB against "
+                                                    + juce::String(expected[worstIndex], 1) + " dB at " + juce::String(worstIndex));
+        }
+
+        // What a sound is compared on: how loud it gets, its level over time in windows doubling in
+        // length from 2.5 ms, and how its energy spreads over octave bands from 31.5 Hz to 16 kHz.
+        // All in dB; the level relative to the loudest window and the bands to the whole sound.
+        struct SoundProfile
+        {
+            static constexpr int numWindows = 11;
+            static constexpr int numBands = 10;
+            float loudest = 0.0f;
+            float level[numWindows];
+            float bands[numBands];
+        };
+
+        static float toDecibels(double power)
+        {
+            return (float)juce::jmax(-120.0, 10.0 * std::log10(power + 1.0e-30));
+        }
+
+        // In place, radix 2; size is a power of two.
+        static void fft(std::vector<std::complex<double>>& data)
+        {
+            const size_t size = data.size();
+            for (size_t i = 1, j = 0; i < size; ++i)
+            {
+                size_t bit = size >> 1;
+                for (; (j & bit) != 0; bit >>= 1)
+                    j ^= bit;
+                j ^= bit;
+                if (i < j)
+                    std::swap(data[i], data[j]);
+            }
+
+            for (size_t length = 2; length <= size; length <<= 1)
+            {
+                const auto step = std::polar(1.0, -2.0 * juce::MathConstants<double>::pi / (double)length);
+                for (size_t start = 0; start < size; start += length)
+                {
+                    std::complex<double> twiddle(1.0, 0.0);
+                    for (size_t k = 0; k < length / 2; ++k)
+                    {
+                        const auto even = data[start + k];
+                        const auto odd = data[start + k + length / 2] * twiddle;
+                        data[start + k] = even + odd;
+                        data[start + k + length / 2] = even - odd;
+                        twiddle *= step;
+                    }
+                }
+            }
+        }
+
+        static SoundProfile profile(const juce::AudioBuffer<float>& data, double sampleRate)
+        {
+            // Both sides of a stereo sound count alike.
+            std::vector<double> mono((size_t)data.getNumSamples(), 0.0);
+            for (int channel = 0; channel < data.getNumChannels(); ++channel)
+                for (int i = 0; i < data.getNumSamples(); ++i)
+                    mono[(size_t)i] += data.getSample(channel, i) / (double)data.getNumChannels();
+
+            SoundProfile result;
+            double loudest = 0.0;
+            double windowPower[SoundProfile::numWindows] = {};
+            for (int window = 0; window < SoundProfile::numWindows; ++window)
+            {
+                const auto start = window == 0 ? (size_t)0 : (size_t)(0.0025 * sampleRate * (double)(1 << (window - 1)));
+                const auto end = juce::jmin(mono.size(), (size_t)(0.0025 * sampleRate * (double)(1 << window)));
+                double sum = 0.0;
+                for (auto i = start; i < end; ++i)
+                    sum += mono[i] * mono[i];
+                windowPower[window] = end > start ? sum / (double)(end - start) : 0.0;
+                loudest = juce::jmax(loudest, windowPower[window]);
+            }
+            result.loudest = toDecibels(loudest);
+            for (int window = 0; window < SoundProfile::numWindows; ++window)
+                result.level[window] = toDecibels(windowPower[window] / juce::jmax(loudest, 1.0e-30));
+
+            // Hann windowed frames, half overlapped, summed into the bands.
+            constexpr size_t frameSize = 4096;
+            double bandPower[SoundProfile::numBands] = {};
+            double total = 0.0;
+            std::vector<std::complex<double>> frame(frameSize);
+            for (size_t start = 0; start < mono.size(); start += frameSize / 2)
+            {
+                for (size_t i = 0; i < frameSize; ++i)
+                {
+                    const double hann = 0.5 - 0.5 * std::cos(2.0 * juce::MathConstants<double>::pi * (double)i / (double)frameSize);
+                    frame[i] = start + i < mono.size() ? mono[start + i] * hann : 0.0;
+                }
+                fft(frame);
+
+                for (size_t bin = 1; bin < frameSize / 2; ++bin)
+                {
+                    const double power = std::norm(frame[bin]);
+                    const double frequency = (double)bin * sampleRate / (double)frameSize;
+                    const int band = (int)std::floor(std::log2(frequency / 31.25) + 0.5);
+                    total += power;
+                    if (band >= 0 && band < SoundProfile::numBands)
+                        bandPower[band] += power;
+                }
+            }
+            for (int band = 0; band < SoundProfile::numBands; ++band)
+                result.bands[band] = toDecibels(bandPower[band] / juce::jmax(total, 1.0e-30));
+
+            return result;
+        }
+
+        // Measured with profile() from the baseline's renders at these settings.
+        struct Baseline
+        {
+            int length;
+            float loudest;
+            float level[SoundProfile::numWindows];
+            float bands[SoundProfile::numBands];
+        };
+
+        static constexpr Baseline baseline[(int)Instrument::Count][numSettings] = {
+            { // Kick
+                { 36602, -2.17f, { -0.2f, -0.7f, -0.1f, -0.6f, 0.0f, -0.6f, -0.5f, -1.5f, -3.1f, -5.5f, -120.0f },
+                  { -13.4f, -0.7f, -10.4f, -19.8f, -32.1f, -51.4f, -68.1f, -72.6f, -72.1f, -70.2f } },
+                { 52214, -1.86f, { 0.0f, -1.0f, -0.3f, -0.3f, -0.5f, -0.5f, -0.7f, -1.0f, -1.9f, -4.0f, -120.0f },
+                  { -7.0f, -1.4f, -13.0f, -22.9f, -36.8f, -51.0f, -55.0f, -58.0f, -60.5f, -61.8f } },
+                { 20991, -1.67f, { -1.0f, 0.0f, -0.5f, -1.0f, -0.8f, -1.1f, -1.5f, -2.5f, -4.2f, -120.0f, -120.0f },
+                  { -13.2f, -3.9f, -3.0f, -14.7f, -25.6f, -39.8f, -44.0f, -47.0f, -49.6f, -51.2f } }
+            },
+            { // Snare
+                { 14332, -9.18f, { 0.0f, -2.2f, -0.7f, -2.1f, -3.7f, -7.4f, -14.8f, -28.7f, -44.5f, -120.0f, -120.0f },
+                  { -51.0f, -60.7f, -16.3f, -4.6f, -24.6f, -19.8f, -15.2f, -10.5f, -7.9f, -4.8f } },
+                { 18698, -8.81f, { 0.0f, -1.3f, -0.8f, -2.1f, -3.6f, -7.6f, -15.3f, -29.3f, -49.5f, -120.0f, -120.0f },
+                  { -57.1f, -55.3f, -6.5f, -9.4f, -24.2f, -19.9f, -14.9f, -10.3f, -7.7f, -4.6f } },
+                { 9966, -9.31f, { 0.0f, -2.4f, -0.9f, -2.0f, -3.9f, -7.6f, -14.9f, -24.5f, -120.0f, -120.0f, -120.0f },
+                  { -64.1f, -48.3f, -50.8f, -5.6f, -8.4f, -21.0f, -15.8f, -10.8f, -8.1f, -5.1f } }
+            },
+            { // Clap
+                { 27782, -14.56f, { 0.0f, -3.0f, -5.1f, -2.7f, -2.6f, -10.5f, -20.2f, -29.5f, -46.1f, -120.0f, -120.0f },
+                  { -74.9f, -65.2f, -44.9f, -38.9f, -23.2f, -15.0f, -9.3f, -6.6f, -5.1f, -5.0f } },
+                { 33339, -15.08f, { 0.0f, -3.0f, -5.2f, -2.3f, -1.7f, -12.0f, -19.4f, -27.7f, -42.7f, -63.4f, -120.0f },
+                  { -62.6f, -57.9f, -42.5f, -36.4f, -22.7f, -14.1f, -8.9f, -6.3f, -5.1f, -5.5f } },
+                { 22226, -13.86f, { 0.0f, -2.9f, -4.8f, -3.2f, -3.7f, -8.4f, -20.9f, -31.2f, -47.3f, -120.0f, -120.0f },
+                  { -73.7f, -66.9f, -52.2f, -41.6f, -26.1f, -17.4f, -11.0f, -6.6f, -4.8f, -4.6f } }
+            },
+            { // Rim
+                { 3527, -10.34f, { 0.0f, -2.0f, -4.0f, -7.9f, -16.3f, -31.5f, -120.0f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -54.5f, -57.6f, -52.8f, -43.0f, -36.6f, -1.6f, -9.0f, -15.9f, -12.3f, -9.9f } },
+                { 4454, -11.02f, { 0.0f, -0.4f, -2.8f, -6.3f, -13.5f, -26.9f, -46.0f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -55.4f, -61.0f, -52.0f, -42.6f, -36.2f, -1.5f, -9.7f, -15.8f, -12.2f, -9.8f } },
+                { 2601, -10.82f, { 0.0f, -1.3f, -4.1f, -8.6f, -18.1f, -31.9f, -120.0f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -58.6f, -59.0f, -52.7f, -43.5f, -37.0f, -27.3f, -1.6f, -8.7f, -12.2f, -9.8f } }
+            },
+            { // Low tom
+                { 25357, -7.61f, { -1.1f, 0.0f, -4.3f, -4.1f, -3.6f, -4.2f, -8.6f, -15.1f, -26.3f, -120.0f, -120.0f },
+                  { -34.5f, -1.2f, -6.3f, -20.0f, -26.4f, -36.4f, -45.8f, -54.8f, -63.7f, -72.0f } },
+                { 35280, -7.85f, { 0.0f, -1.4f, -1.9f, -6.6f, -1.5f, -4.4f, -6.1f, -10.8f, -20.3f, -32.3f, -120.0f },
+                  { -11.3f, -0.7f, -11.2f, -21.9f, -31.4f, -40.1f, -49.4f, -58.3f, -67.2f, -75.0f } },
+                { 15435, -7.29f, { -1.9f, 0.0f, -6.8f, -2.6f, -4.0f, -6.3f, -10.7f, -19.1f, -28.5f, -120.0f, -120.0f },
+                  { -40.5f, -10.8f, -0.4f, -20.7f, -24.1f, -32.3f, -42.3f, -50.9f, -59.2f, -65.2f } }
+            },
+            { // Mid tom
+                { 25357, -8.82f, { 0.0f, -0.1f, -5.7f, -0.2f, -2.9f, -3.3f, -7.2f, -13.7f, -25.3f, -120.0f, -120.0f },
+                  { -60.6f, -34.6f, -0.9f, -7.5f, -19.7f, -31.6f, -39.9f, -48.5f, -57.6f, -66.7f } },
+                { 35280, -7.09f, { -2.1f, 0.0f, -6.7f, -2.3f, -3.6f, -4.5f, -7.1f, -11.4f, -20.7f, -32.6f, -120.0f },
+                  { -37.8f, -5.3f, -1.6f, -21.0f, -24.1f, -34.3f, -43.1f, -52.2f, -61.0f, -68.8f } },
+                { 15435, -8.29f, { 0.0f, -3.3f, -2.9f, -2.2f, -2.8f, -5.3f, -9.3f, -18.0f, -26.9f, -120.0f, -120.0f },
+                  { -60.6f, -36.0f, -1.3f, -6.1f, -20.8f, -24.4f, -35.6f, -44.9f, -53.3f, -60.3f } }
+            },
+            { // High tom
+                { 25357, -8.28f, { 0.0f, -3.2f, -2.8f, -2.0f, -2.3f, -4.4f, -7.3f, -14.2f, -25.8f, -120.0f, -120.0f },
+                  { -69.4f, -35.2f, -1.2f, -6.4f, -20.7f, -24.9f, -36.0f, -45.3f, -54.0f, -62.2f } },
+                { 35280, -8.78f, { -0.0f, -0.1f, -5.7f, 0.0f, -2.5f, -2.4f, -5.3f, -9.8f, -19.2f, -30.8f, -120.0f },
+                  { -59.4f, -33.8f, -0.8f, -8.3f, -20.2f, -31.6f, -40.2f, -48.8f, -57.5f, -65.3f } },
+                { 15435, -8.21f, { 0.0f, -5.8f, -1.2f, -1.8f, -3.5f, -5.3f, -9.4f, -18.0f, -27.1f, -120.0f, -120.0f },
+                  { -60.5f, -56.3f, -35.0f, -0.1f, -20.9f, -24.4f, -31.4f, -41.1f, -50.5f, -59.3f } }
+            },
+            { // Closed hat
+                { 2932, -19.35f, { -0.3f, 0.0f, -1.6f, -4.8f, -11.3f, -22.1f, -120.0f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -86.3f, -79.8f, -77.7f, -70.6f, -47.5f, -36.2f, -25.1f, -6.6f, -1.5f, -11.4f } },
+                { 4057, -20.47f, { -1.1f, 0.0f, -1.2f, -4.5f, -9.7f, -20.1f, -32.6f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -83.9f, -80.4f, -75.8f, -70.6f, -53.7f, -30.3f, -14.5f, -4.4f, -2.7f, -12.2f } },
+                { 1808, -17.13f, { -1.6f, 0.0f, -2.3f, -6.2f, -13.6f, -21.4f, -120.0f, -120.0f, -120.0f, -120.0f, -120.0f },
+                  { -69.0f, -66.9f, -63.1f, -60.3f, -53.0f, -34.9f, -25.7f, -10.4f, -2.6f, -4.4f } }
+            },
+            { // Open hat
+                { 37484, -18.54f, { -2.0f, -0.4f, 0.0f, -0.8f, -1.3f, -2.9f, -5.3f, -9.1f, -14.9f, -21.4f, -120.0f },
+                  { -77.7f, -70.9f, -69.2f, -64.3f, -46.5f, -36.2f, -24.5f, -6.9f, -1.4f, -11.3f } },
+                { 53096, -19.87f, { -2.9f, 0.0f, -0.4f, -0.6f, -1.4f, -2.7f, -5.0f, -8.4f, -13.8f, -22.1f, -120.0f },
+                  { -77.7f, -73.3f, -72.0f, -66.0f, -51.1f, -30.0f, -14.7f, -4.3f, -2.7f, -12.2f } },
+                { 21873, -16.22f, { -2.3f, 0.0f, -0.5f, -1.0f, -1.8f, -3.6f, -6.0f, -10.0f, -14.8f, -120.0f, -120.0f },
+                  { -68.9f, -68.8f, -63.8f, -61.3f, -52.4f, -34.1f, -25.8f, -10.6f, -2.6f, -4.4f } }
+            },
+            { // Crash
+                { 123479, -15.86f, { -0.5f, -0.7f, -0.2f, 0.0f, -0.5f, -0.7f, -1.4f, -2.7f, -5.5f, -10.8f, -20.8f },
+                  { -67.9f, -58.1f, -64.5f, -60.7f, -44.9f, -33.8f, -23.5f, -5.9f, -2.0f, -9.9f } },
+                { 163170, -16.37f, { 0.0f, -0.6f, -0.2f, -0.3f, -0.2f, -0.5f, -1.1f, -2.1f, -4.3f, -8.7f, -17.0f },
+                  { -61.7f, -57.7f, -66.2f, -58.9f, -45.3f, -29.6f, -13.9f, -4.4f, -2.9f, -10.9f } },
+                { 83789, -15.60f, { -0.0f, 0.0f, -0.2f, -0.1f, -0.3f, -0.6f, -1.3f, -2.9f, -6.2f, -12.4f, -21.6f },
+                  { -65.9f, -60.6f, -54.4f, -58.3f, -49.1f, -35.5f, -26.3f, -8.7f, -2.9f, -4.6f } }
+            },
+            { // Ride
+                { 92609, -15.81f, { 0.0f, -0.2f, -0.1f, -0.0f, -0.3f, -0.8f, -1.7f, -3.8f, -7.8f, -15.5f, -27.8f },
+                  { -64.3f, -60.2f, -62.7f, -56.4f, -5.6f, -34.3f, -15.0f, -7.9f, -3.4f, -11.3f } },
+                { 121716, -15.77f, { -0.5f, -0.3f, 0.0f, -0.4f, -0.5f, -1.0f, -2.0f, -3.7f, -7.2f, -13.6f, -25.3f },
+                  { -65.6f, -59.4f, -62.2f, -49.2f, -6.3f, -32.2f, -15.4f, -3.7f, -6.1f, -12.3f } },
+                { 63504, -14.98f, { -0.3f, 0.0f, -0.2f, -0.4f, -0.6f, -1.2f, -2.3f, -4.6f, -9.2f, -18.0f, -27.8f },
+                  { -56.8f, -58.8f, -58.9f, -57.8f, -5.1f, -34.4f, -27.1f, -10.1f, -4.2f, -6.8f } }
+            }
+        };
+    };
+
+    static SynthesisBaselineTests synthesisBaselineTests;
+}
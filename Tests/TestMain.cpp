@@ -0,0 +1,32 @@
+#include <JuceHeader.h>
+
+// Runs the tests named on the command line, or every test when none are, and exits with 1 if
+// any check failed, so each one can be its own ctest entry.
+int main(int argc, char* argv[])
+{
+    juce::StringArray names;
+    for (int i = 1; i < argc; ++i)
+        names.add(argv[i]);
+
+    juce::Array<juce::UnitTest*> tests;
+    for (auto* test : juce::UnitTest::getAllTests())
+    {
+        if (names.isEmpty() || names.contains(test->getName()))
+            tests.add(test);
+    }
+
+    if (tests.isEmpty())
+    {
+        std::printf("No test named %s\n", names.joinIntoString(", ").toRawUTF8());
+        return 1;
+    }
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTests(tests);
+
+    int failures = 0;
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        failures += runner.getResult(i)->failures;
+    return failures > 0 ? 1 : 0;
+}